@@ -9,6 +9,9 @@
 
 #include "parser/Tokenizer.h"
 #include "parser/Parser.h"
+#include "fileio/mappedFile.h"
+#include "scene/sceneCache.h"
+#include "scene/shadowCache.h"
 
 #include "ui/TraceUI.h"
 #include <cmath>
@@ -19,6 +22,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <unordered_map>
 
 using namespace std;
 extern TraceUI* traceUI;
@@ -32,24 +36,135 @@ bool debugMode = false;
 // through the projection plane, and out into the scene.  All we do is
 // enter the main ray-tracing method, getting things started by plugging
 // in an initial ray weight of (0.0,0.0,0.0) and an initial recursion depth of 0.
+// spread is the angular size of the sample, used to filter textures.
 
-glm::dvec3 RayTracer::trace(double x, double y)
+glm::dvec3 RayTracer::trace(double x, double y, double spread,
+                             PrimaryHit* primary)
+{
+	// run the render loop compiled for these settings
+	if (settings.kdTree)
+		return settings.debug ? traceWith<true, true>(x, y, spread, primary)
+		                      : traceWith<true, false>(x, y, spread, primary);
+	return settings.debug ? traceWith<false, true>(x, y, spread, primary)
+	                      : traceWith<false, false>(x, y, spread, primary);
+}
+
+template<bool UseTree, bool Debug>
+glm::dvec3 RayTracer::traceWith(double x, double y, double spread,
+                                PrimaryHit* primary)
 {
 	// Clear out the ray cache in the scene for debugging purposes,
-	if (TraceUI::m_debug)
+	if (Debug)
 	{
 		scene->clearIntersectCache();		
 	}
 
 	ray r(glm::dvec3(0,0,0), glm::dvec3(0,0,0), glm::dvec3(1,1,1), ray::VISIBILITY);
 	scene->getCamera().rayThrough(x,y,r);
-	double dummy;
-	glm::dvec3 ret = traceRay(r, glm::dvec3(1.0,1.0,1.0), traceUI->getDepth(), dummy);
+	r.setCone(0.0, spread);
+	glm::dvec3 ret;
+	if (primary) {
+		findPrimary<UseTree, Debug>(r, *primary);
+		if (reprojecting && reproject(r, *primary, ret))
+			return ret;
+		if (primary->hit)
+			primary->shadedAt = r.at(primary->i);
+		ret = traceFrom<UseTree, Debug>(r, primary->hit, primary->i,
+		                                glm::dvec3(1.0,1.0,1.0), settings.depth);
+	} else {
+		double dummy;
+		ret = traceRay<UseTree, Debug>(r, glm::dvec3(1.0,1.0,1.0), settings.depth, dummy);
+	}
 	ret = glm::clamp(ret, 0.0, 1.0);
 	return ret;
 }
 
-glm::dvec3 RayTracer::tracePixel(int i, int j)
+template<bool UseTree, bool Debug>
+void RayTracer::findPrimary(ray& r, PrimaryHit& p)
+{
+	p.reprojected = false;
+	p.supersampled = false;
+	if (primaryMode == PrimaryMode::Record) {
+		p.hit = scene->intersect<UseTree, Debug>(r, p.i);
+	} else if (p.stale) {
+		// the same object in the same place gives the same hit
+		isect fresh;
+		if (p.i.getObject() && p.i.getObject()->intersect(r, fresh))
+			p.i = fresh;
+		else
+			p.hit = scene->intersect<UseTree, Debug>(r, p.i);
+		p.stale = false;
+	}
+}
+
+// The largest difference, in any channel, between a pixel of the last
+// frame and its neighbours that still lets its color be carried over.
+// A bigger one is an edge, of a shadow or in a texture, and the point
+// seen now may be on the other side of it.
+static const int REPROJECT_MAX_STEP = 4;
+
+bool RayTracer::reproject(const ray& r, PrimaryHit& p, glm::dvec3& color) const
+{
+	// Specular highlights and reflected or refracted light move with
+	// the eye; what is left, ambient, emission and diffuse light, and
+	// the shadows on it, doesn't.
+	if (!p.hit)
+		return false;
+	const Material& m = p.i.getMaterial();
+	if (m.Refl() || m.Trans() || m.ks(p.i) != glm::dvec3(0.0, 0.0, 0.0))
+		return false;
+
+	// the pixel of the last frame P fell in
+	glm::dvec3 P = r.at(p.i);
+	glm::dvec3 c = previousToCamera * (P - previousView.eye);
+	if (!(c[0] > 0.0))
+		return false;
+	int w = previousView.width, h = previousView.height;
+	int i = (int)std::floor((c[1] / c[0] + 0.5) * w + 0.5);
+	int j = (int)std::floor((c[2] / c[0] + 0.5) * h + 0.5);
+	if (i < 0 || i >= w || j < 0 || j >= h)
+		return false;
+
+	// It has to have been shaded from one sample on the same object,
+	// no further from P than the width of a pixel there; otherwise P
+	// was hidden, or the pixel showed an edge.  Colors carried over
+	// frame after frame keep the point they were shaded at, so they
+	// can't drift further than that.
+	const PrimaryHit& q = previousHits[i + j * w];
+	if (!q.hit || q.supersampled || q.i.getObject() != p.i.getObject())
+		return false;
+	if (glm::distance(P, q.shadedAt) > p.i.getT() * pixelSpread)
+		return false;
+
+	const unsigned char* rgb = previousColors.data() + (i + j * w) * 3;
+	static const int step[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	for (auto& s : step) {
+		int ni = i + s[0], nj = j + s[1];
+		if (ni < 0 || ni >= w || nj < 0 || nj >= h)
+			continue;
+		const unsigned char* n = previousColors.data() + (ni + nj * w) * 3;
+		for (int c = 0; c < 3; c++)
+			if (std::abs(n[c] - rgb[c]) > REPROJECT_MAX_STEP)
+				return false;
+	}
+
+	// the +0.5 makes writing it back out give the same bytes
+	color = (glm::dvec3(rgb[0], rgb[1], rgb[2]) + 0.5) / 255.0;
+	p.reprojected = true;
+	p.shadedAt = q.shadedAt;
+	return true;
+}
+
+int RayTracer::reprojectedPixels() const
+{
+	int n = 0;
+	if (primaryMode != PrimaryMode::Trace)
+		for (const PrimaryHit& p : primaryHits)
+			n += p.reprojected;
+	return n;
+}
+
+glm::dvec3 RayTracer::tracePixel(int i, int j, PrimaryHit* primary)
 {
 	glm::dvec3 col(0,0,0);
 
@@ -59,7 +174,7 @@ glm::dvec3 RayTracer::tracePixel(int i, int j)
 	double y = double(j)/double(buffer_height);
 
 	unsigned char *pixel = buffer.data() + ( i + j * buffer_width ) * 3;
-	col = trace(x, y);
+	col = trace(x, y, pixelSpread, primary);
 
 	pixel[0] = (int)( 255.0 * col[0]);
 	pixel[1] = (int)( 255.0 * col[1]);
@@ -69,53 +184,50 @@ glm::dvec3 RayTracer::tracePixel(int i, int j)
 
 #define VERBOSE 0
 
-// Do recursive ray tracing!  You'll want to insert a lot of code here
-// (or places called from here) to handle reflection, refraction, etc etc.
-glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, double& t )
-{
-	// add base case, just return 0 vector
-	if (depth < 0){
-		return glm::dvec3(0.0, 0.0, 0.0);
-	}
-
-	if (thresh[0] < traceUI->getThreshold() && thresh[1] < traceUI->getThreshold() && thresh[2] < traceUI->getThreshold()) {
-		return glm::dvec3(0.0, 0.0, 0.0); 
+// A reflected or refracted ray waiting to be traced, with the weight
+// its color carries into the pixel: the product of the kr and kt of
+// the surfaces on its way back to the primary ray.  pixel is only
+// used by the wavefront path, which traces many pixels at once.
+struct PendingRay {
+	PendingRay(const glm::dvec3& p, const glm::dvec3& d, ray::RayType type,
+	           double coneWidth, double coneSpread,
+	           const glm::dvec3& weight, int depth, int pixel = -1)
+	        : r(p, d, glm::dvec3(1, 1, 1), type), weight(weight), depth(depth),
+	          pixel(pixel)
+	{
+		r.setCone(coneWidth, coneSpread);
 	}
 
-	isect i;
-	glm::dvec3 colorC;
-#if VERBOSE
-	std::cerr << "== current depth: " << depth << std::endl;
-#endif
-
-	if(scene->intersect(r, i)) {
-		// YOUR CODE HERE
-
-		// An intersection occurred!  We've got work to do.  For now,
-		// this code gets the material for the surface that was intersected,
-		// and asks that material to provide a color for the ray.
-
-		// This is a great place to insert code for recursive ray tracing.
-		// Instead of just returning the result of shade(), add some
-		// more steps: add in the contributions from reflected and refracted
-		// rays.
-
+	ray r;
+	glm::dvec3 weight;
+	int depth;
+	int pixel;
+};
+
+// The reflected and refracted rays a hit spawns, if any, with the
+// weights they carry.
+struct Bounce {
+	glm::dvec3 position;	// the hit
+	double footprint;		// width of the ray cone at the hit
+	bool reflects = false;
+	bool refracts = false;
+	glm::dvec3 reflectDir, refractDir;
+	glm::dvec3 reflectWeight, refractWeight;
+
+	// Work out the rays spawned where r, carrying weight, hits i.
+	Bounce(const ray& r, const isect& i, const glm::dvec3& weight)
+	{
 		const Material& m = i.getMaterial();
-		t = i.getT();
-		colorC = m.shade(scene.get(), r, i);
-
-		glm::dvec3 position = r.at(i);
+		position = r.at(i);
+		footprint = r.footprintAt(i.getT());
 		glm::dvec3 d = glm::normalize(r.getDirection());
-		glm::dvec3 l = -d;
 		glm::dvec3 n = glm::normalize(i.getN());
 
 		// Handle reflection
 		if (m.Refl()) {
-			glm::dvec3 direction = glm::normalize(d - (2 * glm::dot(d, n) * n));
-
-			// recurse on the ray
-			ray reflect = ray(position + RAY_EPSILON * direction, direction, glm::dvec3(1, 1, 1), ray::REFLECTION);
-			colorC += m.kr(i) * traceRay(reflect, m.kr(i) * thresh, depth - 1, t);
+			reflectDir = glm::normalize(d - (2 * glm::dot(d, n) * n));
+			reflectWeight = weight * m.kr(i);
+			reflects = true;
 		}
 
 		// Handle refraction
@@ -143,48 +255,267 @@ glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, doub
 			double w = eta * cosd;
 			double k = 1 + (w - eta) * (w + eta);
 
-			if(k > 0){
-				glm::dvec3 direction = glm::normalize((w - sqrt(k)) * normalSign + eta * d);
+			if (k > 0) {
+				refractDir = glm::normalize((w - sqrt(k)) * normalSign + eta * d);
+				refractWeight = weight * m.kt(i);
+				refracts = true;
+			}
+		}
+	}
+
+	// Push the spawned rays that are worth tracing onto rays,
+	// refraction first.
+	template<class Worth>
+	void spawn(std::vector<PendingRay>& rays, double spread, int depth,
+	           int pixel, Worth worthTracing) const
+	{
+		if (refracts && worthTracing(refractWeight, depth))
+			rays.emplace_back(position + RAY_EPSILON * refractDir, refractDir,
+			                  ray::REFRACTION, footprint, spread,
+			                  refractWeight, depth, pixel);
+		if (reflects && worthTracing(reflectWeight, depth))
+			rays.emplace_back(position + RAY_EPSILON * reflectDir, reflectDir,
+			                  ray::REFLECTION, footprint, spread,
+			                  reflectWeight, depth, pixel);
+	}
+};
 
-				// recurse on the ray
-				ray refract = ray(position + RAY_EPSILON * direction, direction, glm::dvec3(1, 1, 1), ray::REFRACTION);
-				glm::dvec3 tempColor = traceRay(refract, m.kt(i) * thresh, depth - 1, t);
+bool RayTracer::worthTracing(const glm::dvec3& share, int depth) const
+{
+	return depth >= 0 && !(share[0] < settings.threshold &&
+	                       share[1] < settings.threshold &&
+	                       share[2] < settings.threshold);
+}
 
-				colorC += m.kt(i) * tempColor;
-			} else {
+// Trace r and the reflected and refracted rays it spawns.  length is
+// set to the distance to the first hit.
+template<bool UseTree, bool Debug>
+glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, double& t )
+{
+	if (!worthTracing(thresh, depth))
+		return glm::dvec3(0.0, 0.0, 0.0);
 
-			}
+	isect i;
+	bool hit = scene->intersect<UseTree, Debug>(r, i);
+	if (hit)
+		t = i.getT();
+	return traceFrom<UseTree, Debug>(r, hit, i, thresh, depth);
+}
+
+// Shade r's first hit, and trace the reflected and refracted rays it
+// spawns.  Instead of recursing, spawned rays wait on a per-thread
+// stack together with their weight, and each ray's shading is added
+// to the result scaled by it.  thresh times the weight is what the
+// recursive version passed down as thresh, and a ray whose share would
+// fall under the threshold, or that would go past the recursion depth,
+// is never pushed.  Only the sibling of each ray on the current path
+// can be waiting, so the stack never holds more than depth + 2 rays.
+template<bool UseTree, bool Debug>
+glm::dvec3 RayTracer::traceFrom(ray& r, bool hit, const isect& first,
+                                const glm::dvec3& thresh, int depth)
+{
+	static thread_local std::vector<PendingRay> pending;
+
+	auto worth = [&](const glm::dvec3& weight, int d) {
+		return worthTracing(thresh * weight, d);
+	};
+
+	glm::dvec3 colorC(0.0, 0.0, 0.0);
+	if (!worth(glm::dvec3(1.0, 1.0, 1.0), depth))
+		return colorC;
+
+	pending.clear();
+	ray* cur = &r;
+	glm::dvec3 weight(1.0, 1.0, 1.0);
+	int curDepth = depth;
+	isect i = first;
+	bool primary = true;
+
+	for (;;) {
+#if VERBOSE
+		std::cerr << "== current depth: " << curDepth << std::endl;
+#endif
+		if (!primary)
+			hit = scene->intersect<UseTree, Debug>(*cur, i);
+		if (hit) {
+			colorC += weight * i.getMaterial().shade(scene.get(), *cur, i);
+		} else if (settings.cubeMap) {
+			// No intersection.  This ray travels to infinity, so we
+			// color it with the cube map if there is one, else black.
+			colorC += weight * settings.cubeMap->getColor(*cur);
 		}
-	} else {
-		// No intersection.  This ray travels to infinity, so we color
-		// it according to the background color, which in this (simple) case
-		// is just black.
-		//
-		// FIXME: Add CubeMap support here.
-		// TIPS: CubeMap object can be fetched from traceUI->getCubeMap();
-		//       Check traceUI->cubeMap() to see if cubeMap is loaded
-		//       and enabled.
-
-		if (traceUI->cubeMap()) {
-			colorC = traceUI->getCubeMap()->getColor(r);
-		} else {
-			colorC = glm::dvec3(0.0, 0.0, 0.0);
+
+		double spread = cur->getConeSpread();
+		if (hit) {
+			// cur is only read before it comes off the stack
+			Bounce bounce(*cur, i, weight);
+			if (!primary)
+				pending.pop_back();
+			// reflection goes on top, so it is traced first as before
+			bounce.spawn(pending, spread, curDepth - 1, -1, worth);
+		} else if (!primary) {
+			pending.pop_back();
 		}
+		if (pending.empty())
+			break;
 
+		cur = &pending.back().r;
+		weight = pending.back().weight;
+		curDepth = pending.back().depth;
+		primary = false;
 	}
 #if VERBOSE
-	std::cerr << "== depth: " << depth+1 << " done, returning: " << colorC << std::endl;
+	std::cerr << "== done, returning: " << colorC << std::endl;
 #endif
 	return colorC;
 }
 
+// Pixels per side of the tiles the wavefront path works on.
+static const int WAVEFRONT_TILE = 32;
+
+// Order secondary rays by the octant they head into, then by where
+// they start, along a Morton curve through the scene's bounds, so
+// that rays tested one after another visit the same kd-tree nodes.
+static uint32_t coherenceKey(const ray& r, const BoundingBox& bounds)
+{
+	glm::dvec3 d = r.getDirection();
+	uint32_t octant = (d[0] < 0.0 ? 1 : 0) | (d[1] < 0.0 ? 2 : 0) |
+	                  (d[2] < 0.0 ? 4 : 0);
+
+	glm::dvec3 size = bounds.getMax() - bounds.getMin();
+	glm::dvec3 p = r.getPosition() - bounds.getMin();
+	uint32_t code = 0;
+	uint32_t cell[3];
+	for (int a = 0; a < 3; a++) {
+		double f = size[a] > 0.0 ? p[a] / size[a] : 0.0;
+		cell[a] = (uint32_t)(glm::clamp(f, 0.0, 1.0) * 511.0);
+	}
+	for (int bit = 8; bit >= 0; bit--)
+		for (int a = 0; a < 3; a++)
+			code = (code << 1) | ((cell[a] >> bit) & 1);
+	return (octant << 27) | code;
+}
+
+// Trace one tile a generation of rays at a time: all primary rays,
+// then all the rays they spawn, and so on.  Each generation is
+// intersected as a batch in coherence order, and its hits are shaded
+// grouped by the object hit, so by material.  Every pixel ends up with
+// the same sum of weighted shading traceRay gives it.
+template<bool UseTree>
+void RayTracer::traceTile(int x0, int y0, int x1, int y1)
+{
+	static thread_local std::vector<PendingRay> rays, next;
+	static thread_local std::vector<isect> hits;
+	static thread_local std::vector<uint32_t> order, keys;
+	static thread_local std::vector<glm::dvec3> colors;
+	static thread_local std::vector<char> hit;
+
+	auto worth = [this](const glm::dvec3& weight, int d) {
+		return worthTracing(weight, d);
+	};
+
+	int tileW = x1 - x0;
+	colors.assign(tileW * (y1 - y0), glm::dvec3(0.0, 0.0, 0.0));
+	rays.clear();
+	if (worth(glm::dvec3(1.0, 1.0, 1.0), settings.depth)) {
+		for (int j = y0; j < y1; j++) {
+			for (int i = x0; i < x1; i++) {
+				rays.emplace_back(glm::dvec3(0, 0, 0), glm::dvec3(0, 0, 0),
+				                  ray::VISIBILITY, 0.0, pixelSpread,
+				                  glm::dvec3(1.0, 1.0, 1.0), settings.depth,
+				                  (i - x0) + (j - y0) * tileW);
+				scene->getCamera().rayThrough(double(i) / double(buffer_width),
+				                              double(j) / double(buffer_height),
+				                              rays.back().r);
+			}
+		}
+	}
+
+	bool primary = true;
+	while (!rays.empty()) {
+		size_t n = rays.size();
+		order.resize(n);
+		for (size_t k = 0; k < n; k++)
+			order[k] = (uint32_t)k;
+		// primary rays are coherent already, in scanline order
+		if (!primary) {
+			keys.resize(n);
+			for (size_t k = 0; k < n; k++)
+				keys[k] = coherenceKey(rays[k].r, scene->bounds());
+			std::sort(order.begin(), order.end(), [](uint32_t a, uint32_t b) {
+				return keys[a] < keys[b] || (keys[a] == keys[b] && a < b);
+			});
+		}
+
+		if (hits.size() < n)
+			hits.resize(n);
+		hit.resize(n);
+		if (primary && primaryMode != PrimaryMode::Trace) {
+			for (uint32_t k : order) {
+				int pixel = rays[k].pixel;
+				PrimaryHit& p = primaryHits[(x0 + pixel % tileW) +
+				                            (y0 + pixel / tileW) * buffer_width];
+				findPrimary<UseTree, false>(rays[k].r, p);
+				hit[k] = p.hit;
+				hits[k] = p.i;
+				glm::dvec3 color;
+				if (reprojecting && reproject(rays[k].r, p, color)) {
+					// colored already; shade nothing
+					colors[pixel] = color;
+					hit[k] = false;
+					rays[k].weight = glm::dvec3(0.0, 0.0, 0.0);
+				} else if (p.hit) {
+					p.shadedAt = rays[k].r.at(p.i);
+				}
+			}
+		} else {
+			for (uint32_t k : order)
+				hit[k] = scene->intersect<UseTree, false>(rays[k].r, hits[k]);
+		}
+
+		// misses first, then hits grouped by object
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			const SceneObject* oa = hit[a] ? hits[a].getObject() : nullptr;
+			const SceneObject* ob = hit[b] ? hits[b].getObject() : nullptr;
+			return oa < ob || (oa == ob && a < b);
+		});
+
+		next.clear();
+		for (uint32_t k : order) {
+			PendingRay& p = rays[k];
+			if (hit[k]) {
+				colors[p.pixel] += p.weight *
+				        hits[k].getMaterial().shade(scene.get(), p.r, hits[k]);
+				Bounce(p.r, hits[k], p.weight)
+				        .spawn(next, p.r.getConeSpread(), p.depth - 1, p.pixel, worth);
+			} else if (settings.cubeMap) {
+				colors[p.pixel] += p.weight * settings.cubeMap->getColor(p.r);
+			}
+		}
+		std::swap(rays, next);
+		primary = false;
+	}
+
+	for (int j = y0; j < y1; j++) {
+		for (int i = x0; i < x1; i++) {
+			glm::dvec3 col = glm::clamp(colors[(i - x0) + (j - y0) * tileW], 0.0, 1.0);
+			unsigned char *pixel = buffer.data() + ( i + j * buffer_width ) * 3;
+			pixel[0] = (int)( 255.0 * col[0]);
+			pixel[1] = (int)( 255.0 * col[1]);
+			pixel[2] = (int)( 255.0 * col[2]);
+		}
+	}
+}
+
 RayTracer::RayTracer()
-	: scene(nullptr), buffer(0), thresh(0), buffer_width(0), buffer_height(0), m_bBufferReady(false)
+	: scene(nullptr), buffer(0), thresh(0), buffer_width(0), buffer_height(0), pixelSpread(0), m_bBufferReady(false)
 {
 }
 
 RayTracer::~RayTracer()
 {
+	waitRender();
+	stopWorkers();
 }
 
 void RayTracer::getBuffer( unsigned char *&buf, int &w, int &h )
@@ -201,13 +532,26 @@ double RayTracer::aspectRatio()
 
 bool RayTracer::loadScene(const char* fn)
 {
-	ifstream ifs(fn);
-	if( !ifs ) {
-		string msg( "Error: couldn't read scene file " );
-		msg.append( fn );
-		traceUI->alert( msg );
+	string error;
+	std::unique_ptr<Scene> next = readScene( fn, traceUI->sceneCacheSw(),
+	                                         traceUI->bakeMeshesSw(), error );
+	if (!next) {
+		traceUI->alert( error );
 		return false;
 	}
+	useScene( std::move(next) );
+	return true;
+}
+
+std::unique_ptr<Scene> RayTracer::readScene(const char* fn, bool useCache,
+                                            bool bakeMeshes, string& error)
+{
+	MappedFile source( fn );
+	if( !source.isOpen() ) {
+		error = "Error: couldn't read scene file ";
+		error.append( fn );
+		return nullptr;
+	}
 
 	// Strip off filename, leaving only the path:
 	string path( fn );
@@ -216,31 +560,89 @@ bool RayTracer::loadScene(const char* fn)
 	else
 		path = path.substr(0, path.find_last_of( "\\/" ));
 
+	// A scene we've parsed before is rebuilt from its binary cache,
+	// as long as the text hasn't changed since.
+	uint64_t sourceHash = 0;
+	uint32_t options = 0;
+	if (bakeMeshes)
+		options |= SceneCache::BAKED_MESHES;
+	string cacheFile = SceneCache::cacheFileFor( fn );
+	if (useCache)
+		sourceHash = SceneCache::hash( source.data(), source.size() );
+
 	// Call this with 'true' for debug output from the tokenizer
-	Tokenizer tokenizer( ifs, false );
+	Tokenizer tokenizer( source.data(), source.size(), false );
 	Parser parser( tokenizer, path );
+	parser.setBakeMeshes( bakeMeshes );
 	try {
-		scene.reset(parser.parseScene());
+		// Whatever scene is loaded is still alive while this one is
+		// parsed, so textures they share are found in the
+		// TextureCache rather than decoded again.
+		std::unique_ptr<Scene> parsed;
+		if (useCache)
+			parsed.reset(SceneCache::load( cacheFile, path, sourceHash, options ));
+		bool fromCache = parsed != nullptr;
+		if (!fromCache)
+			parsed.reset(parser.parseScene());
+		parsed->loadTextures();
+		if (useCache && !fromCache)
+			SceneCache::save( *parsed, cacheFile, path, sourceHash, options );
+		if (useCache)
+			parsed->setTreeCache( SceneCache::treeFileFor( fn ), sourceHash, options );
+		return parsed;
 	}
 	catch( SyntaxErrorException& pe ) {
-		traceUI->alert( pe.formattedMessage() );
-		return false;
+		error = pe.formattedMessage();
 	} catch( ParserException& pe ) {
-		string msg( "Parser: fatal exception " );
-		msg.append( pe.message() );
-		traceUI->alert( msg );
-		return false;
+		error = "Parser: fatal exception ";
+		error.append( pe.message() );
 	} catch( TextureMapException e ) {
-		string msg( "Texture mapping exception: " );
-		msg.append( e.message() );
-		traceUI->alert( msg );
-		return false;
+		error = "Texture mapping exception: ";
+		error.append( e.message() );
 	}
+	return nullptr;
+}
 
-	if (!sceneLoaded())
-		return false;
+void RayTracer::useScene(std::unique_ptr<Scene> next)
+{
+	keepPrimaryHits(*next);
+	scene = std::move(next);
+	sceneChanged = true;
+}
 
-	return true;
+void RayTracer::keepPrimaryHits(const Scene& next)
+{
+	if (!primaryHitsValid)
+		return;
+	primaryHitsValid = false;
+	uint64_t geometry = SceneCache::geometryHash(next);
+	if (!geometry || geometry != SceneCache::geometryHash(*scene))
+		return;
+
+	// Same geometry, so the same objects in the same order.
+	std::unordered_map<const Geometry*, const SceneObject*> moved;
+	auto o = scene->beginObjects();
+	for (auto n = next.beginObjects(); n != next.endObjects(); ++n, ++o)
+		moved[o->get()] = dynamic_cast<const SceneObject*>(n->get());
+	for (PrimaryHit& p : primaryHits) {
+		if (p.hit) {
+			p.i.setObject(moved[p.i.getObject()]);
+			p.stale = true;
+		}
+	}
+	primaryHitsValid = true;
+}
+
+void RayTracer::setCamera(const glm::dvec3& eye, const glm::dvec3& viewDir,
+                          const glm::dvec3& upDir, double fov)
+{
+	// Camera::setLook wants them at right angles and unit length
+	glm::dvec3 look = glm::normalize(viewDir);
+	glm::dvec3 right = glm::normalize(glm::cross(look, upDir));
+	Camera& camera = scene->getCamera();
+	camera.setEye(eye);
+	camera.setLook(look, glm::cross(right, look));
+	camera.setFOV(fov);
 }
 
 void RayTracer::traceSetup(int w, int h)
@@ -264,23 +666,72 @@ void RayTracer::traceSetup(int w, int h)
 	thresh = traceUI->getThreshold();
 	samples = traceUI->getSuperSamples();
 	aaThresh = traceUI->getAaThreshold();
+	pixelSpread = glm::length(scene->getCamera().getV()) / double(h);
 
 	// YOUR CODE HERE
 	// FIXME: Additional initializations
 
-	// build kd tree
-	if (traceUI->kdSwitch())
+	// blur and mip the cube map now so misses cost one filtered lookup
+	if (traceUI->cubeMap())
+		traceUI->getCubeMap()->prefilter(traceUI->getFilterWidth());
+
+	syncSettings();
+	// count shadow cache hits for this render alone
+	ShadowCache::resetStats();
+}
+
+void RayTracer::syncSettings()
+{
+	RenderSettings s;
+	s.depth = traceUI->getDepth();
+	s.threshold = traceUI->getThreshold();
+	s.kdTree = traceUI->kdSwitch();
+	s.smoothShade = traceUI->smShadSw();
+	s.shadows = traceUI->shadowSw();
+	s.debug = TraceUI::m_debug;
+	s.cubeMap = traceUI->cubeMap() ? traceUI->getCubeMap() : nullptr;
+	s.wavefront = traceUI->wavefrontSw();
+	s.lightSamples = traceUI->getLightSamples();
+	// Setting the scene up again would also empty what the render
+	// threads remember about it (ShadowCache), so only do it when
+	// something changed.
+	if (sceneChanged || s != settings) {
+		settings = s;
+		scene->setRenderSettings(settings);
+		sceneChanged = false;
+	}
+
+	// build kd tree; kept if it was built with these parameters
+	if (settings.kdTree)
 		scene->buildTree(traceUI->getMaxDepth(), traceUI->getLeafSize());
 }
 
 void RayTracer::traceImageThread(int id, int w, int h) {
-	for (int p = id; p < w * h; p += threads) {
-		int i = (int) p / buffer_height;
-		int j = p % buffer_height;
-		glm::dvec3 s = tracePixel(i, j);
+	// The debugging view wants one pixel's rays at a time, so it
+	// always gets the pixel by pixel path.
+	if (settings.wavefront && !settings.debug) {
+		int tilesX = (w + WAVEFRONT_TILE - 1) / WAVEFRONT_TILE;
+		int tilesY = (h + WAVEFRONT_TILE - 1) / WAVEFRONT_TILE;
+		for (int tile = id; tile < tilesX * tilesY; tile += threads) {
+			int x0 = (tile % tilesX) * WAVEFRONT_TILE;
+			int y0 = (tile / tilesX) * WAVEFRONT_TILE;
+			int x1 = std::min(x0 + WAVEFRONT_TILE, w);
+			int y1 = std::min(y0 + WAVEFRONT_TILE, h);
+			if (settings.kdTree)
+				traceTile<true>(x0, y0, x1, y1);
+			else
+				traceTile<false>(x0, y0, x1, y1);
+		}
+	} else {
+		for (int p = id; p < w * h; p += threads) {
+			int i = (int) p / buffer_height;
+			int j = p % buffer_height;
+			PrimaryHit* primary = nullptr;
+			if (primaryMode != PrimaryMode::Trace)
+				primary = &primaryHits[i + j * buffer_width];
+			glm::dvec3 s = tracePixel(i, j, primary);
+		}
 	}
-
-	finishedThreads.insert(id);
 }
 
 /*
@@ -295,9 +746,54 @@ void RayTracer::traceImageThread(int id, int w, int h) {
  */
 void RayTracer::traceImage(int w, int h)
 {
+	// The last frame, as it is before traceSetup clears the image,
+	// and whether it was rendered the way this one will be.
+	bool sameScene = !sceneChanged;
+	RenderSettings lastSettings = settings;
+	if (reprojection)
+		previousColors = buffer;
+
 	// Always call traceSetup before rendering anything.
 	traceSetup(w,h);
 
+	// If nothing the primary rays depend on has changed since the last
+	// render, shade what they hit then; otherwise keep what they hit
+	// now for the next one.  The debugging view wants every ray
+	// traced.
+	PrimaryView view;
+	view.eye = scene->getCamera().getEye();
+	view.look = scene->getCamera().getLook();
+	view.u = scene->getCamera().getU();
+	view.v = scene->getCamera().getV();
+	view.width = w;
+	view.height = h;
+	view.smoothShade = settings.smoothShade;
+	reprojecting = false;
+	if (settings.debug || !worthTracing(glm::dvec3(1.0, 1.0, 1.0), settings.depth)) {
+		primaryMode = PrimaryMode::Trace;
+		primaryHitsValid = false;
+	} else if (primaryHitsValid && view == primaryView) {
+		primaryMode = PrimaryMode::Reuse;
+	} else {
+		// A new view of the same scene, lit the same way: its hits
+		// are the last frame for this one to reproject from.
+		reprojecting = reprojection && primaryHitsValid && sameScene &&
+		               settings == lastSettings &&
+		               primaryView.width == w && primaryView.height == h &&
+		               primaryView.smoothShade == view.smoothShade;
+		if (reprojecting) {
+			std::swap(previousHits, primaryHits);
+			previousView = primaryView;
+			previousToCamera = glm::inverse(glm::dmat3(previousView.look,
+			                                           previousView.u,
+			                                           previousView.v));
+		}
+		primaryMode = PrimaryMode::Record;
+		primaryHits.assign(w * h, PrimaryHit());
+		primaryView = view;
+		primaryHitsValid = true;
+	}
+
 	// YOUR CODE HERE
 	// FIXME: Start one or more threads for ray tracing
 	//
@@ -307,19 +803,22 @@ void RayTracer::traceImage(int w, int h)
 	//       An asynchronous traceImage lets the GUI update your results
 	//       while rendering.
 
-	for (int t = 0; t < threads; ++t) {
-		std::thread imageThread(&RayTracer::traceImageThread, this, t, w, h);
-		allThreads.push_back(std::move(imageThread));
-	}
+	runJob([this, w, h](int id) { traceImageThread(id, w, h); });
 }
 
 void RayTracer::aaImageThread(int id, int w, int h) {
 	double x_offset = 1.0 / double(buffer_width * samples);
 	double y_offset = 1.0 / double(buffer_height * samples);
 
+	// only the hits of this image say which pixels were carried over
+	bool known = primaryMode != PrimaryMode::Trace &&
+	             primaryView.width == w && primaryView.height == h;
+
 	for (int p = id; p < w * h; p += threads) {
 		int i = (int) p / buffer_height;
 		int j = p % buffer_height;
+		if (known && primaryHits[i + j * w].reprojected)
+			continue;
 		
 		glm::dvec3 color = getPixel(i, j);
 
@@ -363,16 +862,16 @@ void RayTracer::aaImageThread(int id, int w, int h) {
 
 				for (int b = 0; b < samples; ++b) {
 					double y_sample = y + (double(b) * y_offset);
-					newColor += trace(x_sample, y_sample) / double(totalSamples);
+					newColor += trace(x_sample, y_sample, pixelSpread / samples) / double(totalSamples);
 				}
 			}
 
 			// update the color
 			setPixel(i, j, newColor);
+			if (known)
+				primaryHits[i + j * w].supersampled = true;
 		}
 	}
-
-	finishedThreads.insert(id);
 }
 
 int RayTracer::aaImage()
@@ -386,10 +885,8 @@ int RayTracer::aaImage()
 
 	// start aa threads
 	if (samples > 0) {
-		for (int t = 0; t < threads; ++t) {
-			std::thread imageThread(&RayTracer::aaImageThread, this, t, buffer_width, buffer_height);
-			allThreads.push_back(std::move(imageThread));
-		}
+		int w = buffer_width, h = buffer_height;
+		runJob([this, w, h](int id) { aaImageThread(id, w, h); });
 	}
 
 	return 0;
@@ -404,14 +901,8 @@ bool RayTracer::checkRender()
 	// TIPS: Introduce an array to track the status of each worker thread.
 	//       This array is maintained by the worker threads.
 	
-	for (int i = 0; i < threads; ++i) {
-		if (finishedThreads.find(i) == finishedThreads.end())
-			return false;
-	}
-
-	finishedThreads.clear();
-
-	return true;
+	std::lock_guard<std::mutex> lock(workMutex);
+	return running == 0;
 }
 
 void RayTracer::waitRender()
@@ -423,14 +914,55 @@ void RayTracer::waitRender()
 	//
 	// TIPS: Join all worker threads here.
 
-	// join all threads
-	for (std::thread & th : allThreads) {
-		if (th.joinable()) {
-        	th.join();
-		}
+	// the workers stay up for the next render
+	std::unique_lock<std::mutex> lock(workMutex);
+	workDone.wait(lock, [this] { return running == 0; });
+}
+
+void RayTracer::runJob(std::function<void(int)> work)
+{
+	waitRender();
+	if (allThreads.size() != threads) {
+		stopWorkers();
+		for (unsigned int t = 0; t < threads; ++t)
+			allThreads.emplace_back(&RayTracer::worker, this, (int)t, jobNumber);
 	}
 
-	finishedThreads.clear();
+	std::lock_guard<std::mutex> lock(workMutex);
+	job = std::move(work);
+	jobNumber++;
+	running = threads;
+	workReady.notify_all();
+}
+
+void RayTracer::stopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(workMutex);
+		quitting = true;
+		workReady.notify_all();
+	}
+	for (std::thread& th : allThreads)
+		th.join();
+	allThreads.clear();
+	quitting = false;
+}
+
+void RayTracer::worker(int id, uint64_t done)
+{
+	std::unique_lock<std::mutex> lock(workMutex);
+	for (;;) {
+		workReady.wait(lock, [&] { return quitting || jobNumber != done; });
+		if (quitting)
+			return;
+		done = jobNumber;
+		lock.unlock();
+		job(id);
+		ShadowCache::flushStats();
+		lock.lock();
+		if (--running == 0)
+			workDone.notify_all();
+	}
 }
 
 
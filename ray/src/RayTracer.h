@@ -7,14 +7,37 @@
 
 #include <time.h>
 #include <glm/vec3.hpp>
+#include <glm/mat3x3.hpp>
 #include <queue>
 #include <thread>
 #include "scene/cubeMap.h"
 #include "scene/ray.h"
+#include "scene/renderSettings.h"
+#include <condition_variable>
+#include <functional>
 #include <mutex>
-#include <set>
+#include <string>
 
 class Scene;
+
+// What the primary ray through a pixel hit in the last render.  The
+// whole image's worth is kept so that a render that only changes
+// lights, materials or shading settings can shade these hits again
+// instead of tracing the primary rays (RayTracer::traceImage).
+struct PrimaryHit {
+	bool hit = false;
+	isect i;
+	// i.getObject() was moved over to a reloaded scene; find the hit
+	// on it again before shading, for its material
+	bool stale = false;
+	// the pixel's color came from the last frame (reprojection)
+	bool reprojected = false;
+	// the point that color was shaded at, i's point unless reprojected
+	glm::dvec3 shadedAt;
+	// the anti-aliasing pass replaced the pixel's color
+	bool supersampled = false;
+};
+
 class Pixel {
 public:
 	Pixel(int i, int j, unsigned char* ptr) : ix(i), jy(j), value(ptr) {}
@@ -30,9 +53,16 @@ public:
 	RayTracer();
 	~RayTracer();
 
-	glm::dvec3 tracePixel(int i, int j);
+	// Trace pixel (i,j); given primary, its first hit is found, or
+	// reused, through that entry as the render in progress says.
+	glm::dvec3 tracePixel(int i, int j, PrimaryHit* primary = nullptr);
+	template<bool UseTree, bool Debug>
 	glm::dvec3 traceRay(ray& r, const glm::dvec3& thresh, int depth,
 	                    double& length);
+	// The same, starting from r's first hit, already found.
+	template<bool UseTree, bool Debug>
+	glm::dvec3 traceFrom(ray& r, bool hit, const isect& first,
+	                     const glm::dvec3& thresh, int depth);
 
 	glm::dvec3 getPixel(int i, int j);
 	void setPixel(int i, int j, glm::dvec3 color);
@@ -44,9 +74,40 @@ public:
 	bool checkRender();
 	void waitRender();
 
+	// Get ready to render a w x h image.  The scene side (its render
+	// settings, light index, kd-tree and the cube map filtering) is
+	// only set up again if the scene was loaded or the settings changed
+	// since the last time; a new camera or image size needs nothing
+	// but new primary rays.
 	void traceSetup(int w, int h);
+	// Take the render settings from the UI again, as traceSetup does,
+	// without touching the image.
+	void syncSettings();
+
+	// Point the camera somewhere else, keeping the scene as it is set
+	// up for rendering.
+	void setCamera(const glm::dvec3& eye, const glm::dvec3& viewDir,
+	               const glm::dvec3& upDir, double fov);
+
+	// Render frames of a camera move.  Where a pixel sees the same
+	// point of the same object as a pixel of the last frame did, and
+	// the point's color doesn't depend on where it is seen from, that
+	// pixel's color is carried over instead of shading it again, and
+	// the anti-aliasing pass leaves it alone.
+	void setReprojection(bool on) { reprojection = on; }
+	// How many pixels of the last render were carried over.
+	int reprojectedPixels() const;
 
 	bool loadScene(const char* fn);
+	// loadScene in two halves.  readScene reads scene file fn into a
+	// new scene and touches nothing of the ray tracer's, so the next
+	// scene can be read on another thread while this one renders;
+	// it returns NULL, with the reason in error, if it can't.
+	// useScene then renders next from now on.
+	static std::unique_ptr<Scene> readScene(const char* fn, bool useCache,
+	                                        bool bakeMeshes,
+	                                        std::string& error);
+	void useScene(std::unique_ptr<Scene> next);
 	bool sceneLoaded() { return scene != 0; }
 
 	void setReady(bool ready) { m_bBufferReady = ready; }
@@ -57,7 +118,26 @@ public:
 	bool stopTrace;
 
 private:
-	glm::dvec3 trace(double x, double y);
+	glm::dvec3 trace(double x, double y, double spread,
+	                 PrimaryHit* primary = nullptr);
+	template<bool UseTree, bool Debug>
+	glm::dvec3 traceWith(double x, double y, double spread,
+	                     PrimaryHit* primary);
+	// Bring p up to date with r's first hit, as primaryMode says.
+	template<bool UseTree, bool Debug>
+	void findPrimary(ray& r, PrimaryHit& p);
+	// If the last frame saw where primary ray r hits, as described for
+	// setReprojection, set color to the color it had there and mark p
+	// as carried over.
+	bool reproject(const ray& r, PrimaryHit& p, glm::dvec3& color) const;
+	// Carry the primary hits over to next, a reload of the scene, if
+	// only its lights and materials changed; otherwise drop them.
+	void keepPrimaryHits(const Scene& next);
+	// Trace pixels [x0, x1) x [y0, y1) in wavefront mode.
+	template<bool UseTree>
+	void traceTile(int x0, int y0, int x1, int y1);
+	// Is a ray whose color is scaled by share still worth tracing?
+	bool worthTracing(const glm::dvec3& share, int depth) const;
 
 	std::vector<unsigned char> buffer;
 	int buffer_width, buffer_height;
@@ -67,15 +147,70 @@ private:
 	double thresh;
 	double aaThresh;
 	int samples;
+	double pixelSpread; // angle subtended by one pixel, seeds ray cones
+	RenderSettings settings;
 	std::unique_ptr<Scene> scene;
 
+	// Everything the primary hits depend on besides the geometry: the
+	// view, and the one setting that moves the normals they carry.
+	struct PrimaryView {
+		glm::dvec3 eye, look, u, v;
+		int width = 0, height = 0;
+		bool smoothShade = true;
+
+		bool operator==(const PrimaryView& o) const
+		{
+			return eye == o.eye && look == o.look && u == o.u &&
+			       v == o.v && width == o.width && height == o.height &&
+			       smoothShade == o.smoothShade;
+		}
+	};
+	// What the render in progress does with the primary hits: trace
+	// them as usual, trace them and keep them, or shade the kept ones.
+	enum class PrimaryMode { Trace, Record, Reuse };
+
+	std::vector<PrimaryHit> primaryHits;	// by pixel, i + j * width
+	PrimaryView primaryView;	// what primaryHits were traced for
+	bool primaryHitsValid = false;
+	PrimaryMode primaryMode = PrimaryMode::Trace;
+
+	// The last frame, while the next one is reprojected from it.
+	bool reprojection = false;
+	bool reprojecting = false;	// in the render in progress
+	std::vector<PrimaryHit> previousHits;
+	std::vector<unsigned char> previousColors;
+	PrimaryView previousView;
+	glm::dmat3 previousToCamera;	// world offset from its eye to (s, s x, s y)
+
 	bool m_bBufferReady;
 
+	// What a render depends on comes in two parts.  The scene side is
+	// the scene and the settings it was set up with; it changes when a
+	// scene is loaded (sceneChanged) or the settings do, and traceSetup
+	// then sets the scene up again.  The view side is the camera and
+	// the image size (PrimaryView below); it only decides where the
+	// primary rays go, so changing it costs nothing but tracing them.
+	bool sceneChanged = true;
+
 	void traceImageThread(int id, int w, int h);
 	void aaImageThread(int id, int w, int h);
 
+	// The render threads.  They are started by the first render and
+	// kept, together with what they cache per thread, until the
+	// number of threads asked for changes; each render hands all of
+	// them one job, which worker id runs as job(id).
+	void runJob(std::function<void(int)> job);
+	void stopWorkers();
+	// Run jobs after the one numbered done until told to quit.
+	void worker(int id, uint64_t done);
+
 	std::vector<std::thread> allThreads;
-	std::set<int> finishedThreads;
+	std::mutex workMutex;
+	std::condition_variable workReady, workDone;
+	std::function<void(int)> job;
+	uint64_t jobNumber = 0;
+	unsigned int running = 0;	// workers yet to finish the job
+	bool quitting = false;
 };
 
 #endif // __RAYTRACER_H__
@@ -75,5 +75,7 @@ bool Box::intersectLocal(ray& r, isect& i) const
 											0.5 + intersect_point[ max(i1, i2) ] ) );
 
 		}
+		// one local unit spans the whole texture; widen for foreshortening
+		i.setUVFootprint( r.footprintAt( bestT ) / max( fabs( d[bestIndex % 3] ), 0.05 ) );
         return true;
 }
@@ -6,6 +6,8 @@
 class Cone
 	: public MaterialSceneObject
 {
+	friend class SceneCache;
+	friend class QuadricBatch;
 public:
 	Cone( Scene *scene, Material *mat, 
 			double h = 1.0, double br = 1.0, double tr = 0.0, 
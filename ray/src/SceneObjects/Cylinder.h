@@ -6,6 +6,8 @@
 class Cylinder
 	: public MaterialSceneObject
 {
+	friend class SceneCache;
+	friend class QuadricBatch;
 public:
 	Cylinder( Scene *scene, Material *mat )
 		: MaterialSceneObject( scene, mat ), capped( true )
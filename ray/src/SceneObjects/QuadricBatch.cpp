@@ -0,0 +1,268 @@
+#include <cmath>
+
+#include "QuadricBatch.h"
+#include "Cone.h"
+#include "Cylinder.h"
+#include "Sphere.h"
+
+using namespace std;
+
+// The loops below repeat the arithmetic of each shape's intersectLocal
+// on the local ray Geometry::intersect would make, in the same order,
+// so they pick the same nearest object the full path would.
+
+void QuadricBatch::Placement::add(const Geometry* g, int i)
+{
+	const TransformNode* xf = g->getTransform();
+	const glm::dvec3& o = xf->offset();
+	bool simple = xf->kind() != TransformNode::GENERAL;
+	ox.push_back(simple ? o[0] : 0.0);
+	oy.push_back(simple ? o[1] : 0.0);
+	oz.push_back(simple ? o[2] : 0.0);
+	s.push_back(xf->kind() == TransformNode::UNIFORM_SCALE ? xf->scale() : 1.0);
+	general.push_back(simple ? nullptr : xf);
+	bounds.push_back(g->getBoundingBox());
+	index.push_back(i);
+}
+
+bool QuadricBatch::Placement::localRay(size_t k, const ray& r, double tLimit,
+                                       glm::dvec3& p, glm::dvec3& dir,
+                                       double& tScale, bool& isGeneral) const
+{
+	glm::dvec3 P = r.getPosition();
+	isGeneral = general[k] != nullptr;
+	if (isGeneral) {
+		// the box costs less than the transform
+		double tmin, tmax;
+		if (!bounds[k].intersect(r, tmin, tmax, tLimit))
+			return false;
+		p = general[k]->globalToLocalCoords(P);
+		dir = general[k]->globalToLocalCoords(P + r.getDirection()) - p;
+		tScale = glm::length(dir);
+		dir = glm::normalize(dir);
+		return true;
+	}
+	p = glm::dvec3((P[0] - ox[k]) / s[k], (P[1] - oy[k]) / s[k],
+	               (P[2] - oz[k]) / s[k]);
+	dir = r.getDirection();
+	tScale = s[k];
+	return true;
+}
+
+void QuadricBatch::keepNearest(const Placement& at, size_t k, double t,
+                               bool general, double tScale,
+                               double& bestT, int& best)
+{
+	t = general ? t / tScale : t * tScale;
+	if (t < bestT) {
+		bestT = t;
+		best = at.index[k];
+	}
+}
+
+bool QuadricBatch::add(Geometry* g)
+{
+	int index = (int)objects.size();
+
+	if (dynamic_cast<Sphere*>(g)) {
+		spheres.at.add(g, index);
+	} else if (Cylinder* c = dynamic_cast<Cylinder*>(g)) {
+		cylinders.at.add(g, index);
+		cylinders.capped.push_back(c->capped);
+	} else if (Cone* c = dynamic_cast<Cone*>(g)) {
+		cones.at.add(g, index);
+		cones.height.push_back(c->height);
+		cones.bRadius2.push_back(c->b_radius * c->b_radius);
+		cones.tRadius2.push_back(c->t_radius * c->t_radius);
+		cones.betaSquared.push_back(c->beta_squared);
+		cones.gamma.push_back(c->gamma);
+		cones.capped.push_back(c->capped);
+	} else {
+		return false;
+	}
+
+	objects.push_back(g);
+	return true;
+}
+
+bool QuadricBatch::intersect(ray& r, isect& i, double tMax) const
+{
+	double bestT = tMax;
+	int best = -1;
+
+	nearestSphere(r, bestT, best);
+	nearestCylinder(r, bestT, best);
+	nearestCone(r, bestT, best);
+	if (best < 0)
+		return false;
+
+	if (objects[best]->intersect(r, i, tMax))
+		return true;
+
+	// The full test can still turn the hit down at the very edge of
+	// the object's bounding box; fall back to testing every object.
+	bool have_one = false;
+	for (auto obj : objects) {
+		isect cur;
+		if (obj->intersect(r, cur, have_one ? i.getT() : tMax)) {
+			i = cur;
+			have_one = true;
+		}
+	}
+	return have_one;
+}
+
+// Sphere::intersectLocal: the unit sphere at the origin
+void QuadricBatch::nearestSphere(const ray& r, double& bestT, int& best) const
+{
+	const size_t n = spheres.at.index.size();
+
+	for (size_t k = 0; k < n; k++) {
+		glm::dvec3 p, dir;
+		double tScale;
+		bool general;
+		if (!spheres.at.localRay(k, r, bestT, p, dir, tScale, general))
+			continue;
+
+		double vx = -p[0], vy = -p[1], vz = -p[2];
+		double b = vx * dir[0] + vy * dir[1] + vz * dir[2];
+		double disc = b * b - (vx * vx + vy * vy + vz * vz) + 1;
+		if (disc < 0.0)
+			continue;
+		disc = sqrt(disc);
+		double t2 = b + disc;
+		if (t2 <= RAY_EPSILON)
+			continue;
+		double t1 = b - disc;
+		keepNearest(spheres.at, k, t1 > RAY_EPSILON ? t1 : t2,
+		            general, tScale, bestT, best);
+	}
+}
+
+// Cylinder::intersectLocal: caps and body of the unit cylinder from
+// z = 0 to z = 1
+void QuadricBatch::nearestCylinder(const ray& r, double& bestT, int& best) const
+{
+	const size_t n = cylinders.at.index.size();
+
+	for (size_t k = 0; k < n; k++) {
+		glm::dvec3 p, dir;
+		double tScale;
+		bool general;
+		if (!cylinders.at.localRay(k, r, bestT, p, dir, tScale, general))
+			continue;
+		double px = p[0], py = p[1], pz = p[2];
+
+		// caps
+		double tc = -1.0;
+		if (cylinders.capped[k] && dir[2] != 0.0) {
+			double t1, t2;
+			if (dir[2] > 0.0) {
+				t1 = (-pz) / dir[2];
+				t2 = (1.0 - pz) / dir[2];
+			} else {
+				t1 = (1.0 - pz) / dir[2];
+				t2 = (-pz) / dir[2];
+			}
+			if (t2 >= RAY_EPSILON) {
+				double x = px + t1 * dir[0], y = py + t1 * dir[1];
+				if (t1 >= RAY_EPSILON && x * x + y * y <= 1.0) {
+					tc = t1;
+				} else {
+					x = px + t2 * dir[0];
+					y = py + t2 * dir[1];
+					if (x * x + y * y <= 1.0)
+						tc = t2;
+				}
+			}
+		}
+
+		// body
+		double tb = -1.0;
+		double a = dir[0] * dir[0] + dir[1] * dir[1];
+		if (a != 0.0) {
+			double b = 2.0 * (px * dir[0] + py * dir[1]);
+			double c = px * px + py * py - 1.0;
+			double disc = b * b - 4.0 * a * c;
+			if (disc >= 0.0) {
+				disc = sqrt(disc);
+				double t2 = (-b + disc) / (2.0 * a);
+				if (t2 > RAY_EPSILON) {
+					double t1 = (-b - disc) / (2.0 * a);
+					double z1 = pz + t1 * dir[2];
+					double z2 = pz + t2 * dir[2];
+					if (t1 > RAY_EPSILON && z1 >= 0.0 && z1 <= 1.0)
+						tb = t1;
+					else if (z2 >= 0.0 && z2 <= 1.0)
+						tb = t2;
+				}
+			}
+		}
+
+		double t;
+		if (tc >= 0.0)
+			t = (tb >= 0.0 && tb < tc) ? tb : tc;
+		else if (tb >= 0.0)
+			t = tb;
+		else
+			continue;
+		keepNearest(cylinders.at, k, t, general, tScale, bestT, best);
+	}
+}
+
+// Cone::intersectLocal, root choice and all
+void QuadricBatch::nearestCone(const ray& r, double& bestT, int& best) const
+{
+	const size_t n = cones.at.index.size();
+
+	for (size_t k = 0; k < n; k++) {
+		glm::dvec3 p, dir;
+		double tScale;
+		bool general;
+		if (!cones.at.localRay(k, r, bestT, p, dir, tScale, general))
+			continue;
+		double px = p[0], py = p[1], pz = p[2];
+		double height = cones.height[k];
+		double beta_squared = cones.betaSquared[k];
+		double gamma = cones.gamma[k];
+
+		double a = dir[0] * dir[0] + dir[1] * dir[1] - beta_squared * dir[2] * dir[2];
+		if (a == 0.0)
+			continue;
+		double b = 2 * (px * dir[0] + py * dir[1] - beta_squared * ((pz + gamma) * dir[2]));
+		double c = -beta_squared * (gamma + pz) * (gamma + pz) + px * px + py * py;
+		double disc = b * b - 4 * a * c;
+		if (disc <= 0)
+			continue;
+		disc = sqrt(disc);
+
+		double nearRoot = (-b + disc) / (2 * a);
+		double farRoot = (-b - disc) / (2 * a);
+		double theRoot = RAY_EPSILON;
+
+		double zn = pz + nearRoot * dir[2];
+		bool nearGood = !(zn < 0 || zn > height);
+		if (nearGood && nearRoot > theRoot)
+			theRoot = nearRoot;
+		double zf = pz + farRoot * dir[2];
+		bool farGood = !(zf < 0 || zf > height);
+		if (farGood && ((nearGood && farRoot < theRoot) || farRoot > RAY_EPSILON))
+			theRoot = farRoot;
+
+		if (cones.capped[k]) {
+			double t1 = (-pz) / dir[2];
+			double t2 = (height - pz) / dir[2];
+			double x = px + t1 * dir[0], y = py + t1 * dir[1];
+			if (x * x + y * y <= cones.bRadius2[k] && t1 < theRoot && t1 > RAY_EPSILON)
+				theRoot = t1;
+			x = px + t2 * dir[0];
+			y = py + t2 * dir[1];
+			if (x * x + y * y <= cones.tRadius2[k] && t2 < theRoot && t2 > RAY_EPSILON)
+				theRoot = t2;
+		}
+
+		if (theRoot <= RAY_EPSILON)
+			continue;
+		keepNearest(cones.at, k, theRoot, general, tScale, bestT, best);
+	}
+}
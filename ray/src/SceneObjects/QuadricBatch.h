@@ -0,0 +1,82 @@
+#ifndef __QUADRICBATCH_H__
+#define __QUADRICBATCH_H__
+
+#include <vector>
+
+#include "../scene/scene.h"
+
+/*
+   A QuadricBatch holds the spheres, cylinders and cones of one kd-tree
+   leaf, with their transforms and shape parameters in one array per
+   field, and intersects a ray against all of them in tight loops with
+   no virtual calls and no isect per object.  Objects whose transform
+   is at most a uniform scale and a translation are still axis aligned
+   in world space and need only an offset and a scale; the rest go
+   through their TransformNode as Geometry::intersect does.
+
+   The loops only find the nearest hit.  That object is then
+   intersected once more through Geometry::intersect to fill in the
+   isect, so shading sees exactly what it did before.
+*/
+class QuadricBatch {
+public:
+	// Take g into the batch if it is a sphere, cylinder or cone.
+	// Returns false, leaving g to the caller, otherwise.
+	bool add(Geometry* g);
+
+	bool empty() const { return objects.empty(); }
+	size_t size() const { return objects.size(); }
+	const std::vector<Geometry*>& members() const { return objects; }
+
+	// Intersect r with the nearest object in the batch, as
+	// Geometry::intersect would, and put it in i.  Only hits nearer
+	// than tMax count.
+	bool intersect(ray& r, isect& i, double tMax) const;
+
+private:
+	// Where each object is: an offset and a scale, or for a general
+	// transform the node itself.  One entry per object.
+	struct Placement {
+		std::vector<double> ox, oy, oz, s;
+		std::vector<const TransformNode*> general;	// NULL unless general
+		std::vector<BoundingBox> bounds;	// world space
+		std::vector<int> index;		// into objects
+
+		void add(const Geometry* g, int i);
+		// The ray in the object's space, and the factor that takes its
+		// t back to world space: multiply by it, or divide if general.
+		// False if a general object's bounding box rules the ray out
+		// before tLimit.
+		bool localRay(size_t k, const ray& r, double tLimit, glm::dvec3& p,
+		              glm::dvec3& dir, double& tScale, bool& isGeneral) const;
+	};
+
+	struct Spheres {
+		Placement at;
+	};
+	struct Cylinders {
+		Placement at;
+		std::vector<unsigned char> capped;
+	};
+	struct Cones {
+		Placement at;
+		std::vector<double> height, bRadius2, tRadius2;
+		std::vector<double> betaSquared, gamma;
+		std::vector<unsigned char> capped;
+	};
+
+	static void keepNearest(const Placement& at, size_t k, double t,
+	                        bool general, double tScale,
+	                        double& bestT, int& best);
+
+	void nearestSphere(const ray& r, double& bestT, int& best) const;
+	void nearestCylinder(const ray& r, double& bestT, int& best) const;
+	void nearestCone(const ray& r, double& bestT, int& best) const;
+
+	Spheres spheres;
+	Cylinders cylinders;
+	Cones cones;
+	std::vector<Geometry*> objects;	// in the order they were added
+};
+
+#endif // __QUADRICBATCH_H__
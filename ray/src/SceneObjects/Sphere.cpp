@@ -8,7 +8,7 @@ using namespace std;
 
 bool Sphere::intersectLocal(ray& r, isect& i) const
 {
-	r.setDirection(glm::normalize(r.getDirection()));
+	// Geometry::intersect always hands us a unit direction
 	glm::dvec3 v = -r.getPosition();
 	double b = glm::dot(v, r.getDirection());
 	double discriminant = b*b - glm::dot(v,v) + 1;
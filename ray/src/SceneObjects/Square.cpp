@@ -41,5 +41,7 @@ bool Square::intersectLocal(ray& r, isect& i) const
 	}
 
 	i.setUVCoordinates( glm::dvec2(P[0] + 0.5, P[1] + 0.5) );
+	// one local unit spans the whole texture; widen for foreshortening
+	i.setUVFootprint( r.footprintAt( t ) / max( fabs( d[2] ), 0.05 ) );
 	return true;
 }
@@ -0,0 +1,81 @@
+#include <cmath>
+
+#include "TriangleBatch.h"
+#include "trimesh.h"
+
+using namespace std;
+
+bool TriangleBatch::add(Geometry* g)
+{
+	TrimeshFace* f = dynamic_cast<TrimeshFace*>(g);
+	if (!f || f->getTransform()->kind() != TransformNode::IDENTITY)
+		return false;
+
+	glm::dvec3 a = f->parent->vertices[f->ids[0]];
+	glm::dvec3 b = f->parent->vertices[f->ids[1]];
+	glm::dvec3 c = f->parent->vertices[f->ids[2]];
+	glm::dvec3 n = glm::cross(b - a, c - a);
+
+	// TrimeshFace::intersectLocal never hits a face this small, so
+	// there's nothing to test
+	if (glm::length(n) / 2 < RAY_EPSILON)
+		return true;
+
+	ax.push_back(a[0]); ay.push_back(a[1]); az.push_back(a[2]);
+	bx.push_back(b[0]); by.push_back(b[1]); bz.push_back(b[2]);
+	cx.push_back(c[0]); cy.push_back(c[1]); cz.push_back(c[2]);
+	nx.push_back(n[0]); ny.push_back(n[1]); nz.push_back(n[2]);
+	objects.push_back(g);
+	return true;
+}
+
+bool TriangleBatch::intersect(ray& r, isect& i, double tMax) const
+{
+	const glm::dvec3 p = r.getPosition();
+	const glm::dvec3 d = r.getDirection();
+	double bestT = tMax;
+	int best = -1;
+
+	// The same steps as TrimeshFace::intersectLocal, in the same order,
+	// so this picks the face the full test would.
+	const size_t count = objects.size();
+	for (size_t k = 0; k < count; k++) {
+		glm::dvec3 n(nx[k], ny[k], nz[k]);
+		float f = glm::dot(d, n);
+		if (f >= RAY_EPSILON)
+			continue;
+
+		glm::dvec3 a(ax[k], ay[k], az[k]);
+		glm::dvec3 b(bx[k], by[k], bz[k]);
+		glm::dvec3 c(cx[k], cy[k], cz[k]);
+		double t = glm::dot(b - p, n) / f;
+		if (t < RAY_EPSILON || !(t < bestT))
+			continue;
+
+		glm::dvec3 at = r.at(t);
+		if (glm::dot(n, glm::cross(b - a, at - a)) < 0 ||
+		    glm::dot(n, glm::cross(c - b, at - b)) < 0 ||
+		    glm::dot(n, glm::cross(a - c, at - c)) < 0)
+			continue;
+
+		bestT = t;
+		best = (int)k;
+	}
+	if (best < 0)
+		return false;
+
+	if (objects[best]->intersect(r, i, tMax))
+		return true;
+
+	// The full test can still turn the hit down at the very edge of
+	// the face's bounding box; fall back to testing every face.
+	bool have_one = false;
+	for (auto obj : objects) {
+		isect cur;
+		if (obj->intersect(r, cur, have_one ? i.getT() : tMax)) {
+			i = cur;
+			have_one = true;
+		}
+	}
+	return have_one;
+}
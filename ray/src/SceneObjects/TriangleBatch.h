@@ -0,0 +1,40 @@
+#ifndef __TRIANGLEBATCH_H__
+#define __TRIANGLEBATCH_H__
+
+#include <vector>
+
+#include "../scene/scene.h"
+
+/*
+   A TriangleBatch holds the trimesh faces of one kd-tree leaf that sit
+   directly in world space, which after mesh baking is all of them.
+   Their corners and unnormalized normals are kept in one array per
+   coordinate, and a ray is tested against all of them in one loop,
+   like QuadricBatch does for spheres, cylinders and cones.  Only the
+   nearest face is then intersected through Geometry::intersect, which
+   works out its barycentric coordinates, normal and material.
+*/
+class TriangleBatch {
+public:
+	// Take g into the batch if it is a trimesh face with an identity
+	// transform.  Returns false, leaving g to the caller, otherwise.
+	bool add(Geometry* g);
+
+	bool empty() const { return objects.empty(); }
+	size_t size() const { return objects.size(); }
+	const std::vector<Geometry*>& members() const { return objects; }
+
+	// Intersect r with the nearest face in the batch, as
+	// Geometry::intersect would, and put it in i.  Only hits nearer
+	// than tMax count.
+	bool intersect(ray& r, isect& i, double tMax) const;
+
+private:
+	std::vector<double> ax, ay, az;
+	std::vector<double> bx, by, bz;
+	std::vector<double> cx, cy, cz;
+	std::vector<double> nx, ny, nz;	// cross(b - a, c - a)
+	std::vector<Geometry*> objects;
+};
+
+#endif // __TRIANGLEBATCH_H__
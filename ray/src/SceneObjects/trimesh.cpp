@@ -4,8 +4,6 @@
 #include <string.h>
 #include <algorithm>
 #include <cmath>
-#include "../ui/TraceUI.h"
-extern TraceUI* traceUI;
 
 using namespace std;
 
@@ -33,14 +31,31 @@ void Trimesh::addNormal(const glm::dvec3& n)
 	normals.emplace_back(n);
 }
 
+void Trimesh::addVertices(const std::vector<double>& xyz)
+{
+	vertices.reserve(vertices.size() + xyz.size() / 3);
+	for (size_t i = 0; i + 2 < xyz.size(); i += 3)
+		vertices.emplace_back(xyz[i], xyz[i + 1], xyz[i + 2]);
+}
+
+void Trimesh::addNormals(const std::vector<double>& xyz)
+{
+	normals.reserve(normals.size() + xyz.size() / 3);
+	for (size_t i = 0; i + 2 < xyz.size(); i += 3)
+		normals.emplace_back(xyz[i], xyz[i + 1], xyz[i + 2]);
+}
+
 // Returns false if the vertices a,b,c don't all exist
 bool Trimesh::addFace(int a, int b, int c)
 {
 	int vcnt = vertices.size();
 
-	if (a >= vcnt || b >= vcnt || c >= vcnt)
+	if (a < 0 || b < 0 || c < 0 || a >= vcnt || b >= vcnt || c >= vcnt)
 		return false;
 
+	if (flipWinding)
+		std::swap(b, c);
+
 	TrimeshFace* newFace = new TrimeshFace(
 	        scene, new Material(*this->material), this, a, b, c);
 	newFace->setTransform(this->transform);
@@ -54,6 +69,29 @@ bool Trimesh::addFace(int a, int b, int c)
 	return true;
 }
 
+void Trimesh::bakeTransform(TransformNode* root)
+{
+	if (transform->kind() == TransformNode::IDENTITY)
+		return;
+
+	for (auto& v : vertices)
+		v = transform->localToGlobalCoords(v);
+
+	// Normals are only ever interpolated and then normalized, so leave
+	// their lengths to the normal matrix, as the per-ray path does.
+	glm::dmat3x3 normi = glm::transpose(
+	        glm::inverse(glm::dmat3x3(transform->transform())));
+	for (auto& n : normals)
+		n = normi * n;
+
+	// Faces cull and take their flat normal by winding, which a
+	// negative determinant reverses.
+	if (glm::determinant(glm::dmat3x3(transform->transform())) < 0)
+		flipWinding = true;
+
+	transform = root;
+}
+
 // Check to make sure that if we have per-vertex materials or normals
 // they are the right number.
 const char* Trimesh::doubleCheck()
@@ -78,8 +116,6 @@ bool Trimesh::intersectLocal(ray& r, isect& i) const
 			}
 		}
 	}
-	if (!have_one)
-		i.setT(1000.0);
 	return have_one;
 }
 
@@ -155,7 +191,7 @@ bool TrimeshFace::intersectLocal(ray& r, isect& i) const
 	i.setBary(bar);
 
 	//interpolate normals
-	if (traceUI->smShadSw() && !parent->normals.empty()){
+	if (getScene()->renderSettings().smoothShade && !parent->normals.empty()){
 		glm::dvec3 na = parent->normals[ids[0]];
         glm::dvec3 nb = parent->normals[ids[1]];
         glm::dvec3 nc = parent->normals[ids[2]];
@@ -16,7 +16,9 @@
 class TrimeshFace;
 
 class Trimesh : public MaterialSceneObject {
+	friend class SceneCache;
 	friend class TrimeshFace;
+	friend class TriangleBatch;
 	typedef std::vector<glm::dvec3> Normals;
 	typedef std::vector<glm::dvec3> Vertices;
 	typedef std::vector<TrimeshFace *> Faces;
@@ -26,6 +28,9 @@ class Trimesh : public MaterialSceneObject {
 	Normals normals;
 	Materials materials;
 	BoundingBox localBounds;
+	// Baked through a mirroring transform: faces added since swap their
+	// last two vertices, so they still face the way they did locally.
+	bool flipWinding = false;
 
 public:
 	Trimesh(Scene *scene, Material *mat, TransformNode *transform)
@@ -49,8 +54,18 @@ public:
 	void addVertex(const glm::dvec3 &);
 	void addMaterial(Material *m);
 	void addNormal(const glm::dvec3 &);
+	// bulk versions, taking packed x, y, z triples
+	void addVertices(const std::vector<double> &);
+	void addNormals(const std::vector<double> &);
 	bool addFace(int a, int b, int c);
 
+	// Move the vertices and normals into world space and hang the mesh
+	// off root, which must be the identity.  Faces added afterwards
+	// are intersected without any per-ray transform and get tight
+	// world-space bounds.  A mirroring transform would turn the faces
+	// inside out, so their winding is reversed to make up for it.
+	void bakeTransform(TransformNode *root);
+
 	const char *doubleCheck();
 
 	void generateNormals();
@@ -84,6 +99,8 @@ protected:
 };
 
 class TrimeshFace : public MaterialSceneObject {
+	friend class SceneCache;
+	friend class TriangleBatch;
 	Trimesh *parent;
 	int ids[3];
 	glm::dvec3 normal;
@@ -0,0 +1,55 @@
+#include "mappedFile.h"
+
+#include <fstream>
+#include <iterator>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& filename)
+	: opened(false), mapped(false), bytes(""), length(0)
+{
+#ifndef _WIN32
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd >= 0) {
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+			opened = true;
+			if (st.st_size > 0) {
+				void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p != MAP_FAILED) {
+					mapped = true;
+					bytes = (const char*)p;
+					length = st.st_size;
+				} else {
+					opened = false;
+				}
+			}
+		}
+		close(fd);
+		if (opened)
+			return;
+	}
+#endif
+	// not mappable (or not POSIX): read it in the ordinary way
+	std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+	if (!ifs)
+		return;
+	contents.assign(std::istreambuf_iterator<char>(ifs),
+	                std::istreambuf_iterator<char>());
+	opened = true;
+	bytes = contents.empty() ? "" : contents.data();
+	length = contents.size();
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+	if (mapped)
+		munmap((void*)bytes, length);
+#endif
+}
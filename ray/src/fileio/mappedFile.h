@@ -0,0 +1,36 @@
+#ifndef FILEIO_MAPPEDFILE_H
+#define FILEIO_MAPPEDFILE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * Read-only view of a whole file.
+ * On POSIX systems the file is memory mapped, so large scene files
+ * are paged in on demand instead of being copied through an istream;
+ * elsewhere it falls back to reading the file into memory.
+ */
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& filename);
+	~MappedFile();
+
+	// false if the file could not be opened
+	bool isOpen() const { return opened; }
+
+	const char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool opened;
+	bool mapped;
+	const char* bytes;
+	size_t length;
+	std::vector<char> contents;	// used when the file isn't mapped
+};
+
+#endif
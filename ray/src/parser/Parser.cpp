@@ -28,12 +28,12 @@ Scene* Parser::parseScene()
 {
   _tokenizer.Read(SBT_RAYTRACER);
 
-  unique_ptr<Token> versionNumber( _tokenizer.Read(SCALAR) );
+  Token versionNumber( _tokenizer.Read(SCALAR) );
 
-  if( versionNumber->value() > 1.1 )
+  if( versionNumber.value() > 1.1 )
   {
     ostringstream ost;
-    ost << "SBT-raytracer version number " << versionNumber->value() << 
+    ost << "SBT-raytracer version number " << versionNumber.value() << 
       " too high; only able to parse v1.1 and below.";
     throw ParserException( ost.str() );
   }
@@ -555,7 +555,7 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
   _tokenizer.Read( LBRACE );
 
   bool generateNormals( false );
-  list<glm::dvec3> faces;
+  std::vector<int> faces;     // vertex index triples
 
   const char* error;
   for( ;; )
@@ -599,80 +599,53 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
         break;
 
       case NORMALS:
+      {
         _tokenizer.Read( NORMALS );
         _tokenizer.Read( EQUALS );
-        _tokenizer.Read( LPAREN );
-        if( RPAREN != _tokenizer.Peek()->kind() )
-        {
-          tmesh->addNormal( parseVec3d() );
-          for( ;; )
-          {
-             const Token* nextToken = _tokenizer.Peek();
-             if( RPAREN == nextToken->kind() )
-               break;
-             _tokenizer.Read( COMMA );
-             tmesh->addNormal( parseVec3d() );
-          }
-        }
-        _tokenizer.Read( RPAREN );
+        std::vector<double> xyz;
+        _tokenizer.ReadTupleList( xyz, NULL, 3 );
+        tmesh->addNormals( xyz );
         _tokenizer.Read( SEMICOLON );
         tmesh->vertNorms = true;
         break;
+      }
 
       case FACES:
         _tokenizer.Read( FACES );
         _tokenizer.Read( EQUALS );
-        _tokenizer.Read( LPAREN );
-        if( RPAREN != _tokenizer.Peek()->kind() )
-        {
-          parseFaces( faces );
-          for( ;; )
-          {
-             const Token* nextToken = _tokenizer.Peek();
-             if( RPAREN == nextToken->kind() )
-               break;
-             _tokenizer.Read( COMMA );
-             parseFaces( faces );
-          }
-        }
-        _tokenizer.Read( RPAREN );
+        parseFaces( faces );
         _tokenizer.Read( SEMICOLON );
         break;
 
       case POLYPOINTS:
+      {
         _tokenizer.Read( POLYPOINTS );
         _tokenizer.Read( EQUALS );
-        _tokenizer.Read( LPAREN );
-        if( RPAREN != _tokenizer.Peek()->kind() )
-        {
-          tmesh->addVertex( parseVec3d() );
-          for( ;; )
-          {
-             const Token* nextToken = _tokenizer.Peek();
-             if( RPAREN == nextToken->kind() )
-               break;
-             _tokenizer.Read( COMMA );
-             tmesh->addVertex( parseVec3d() );
-          }
-        }
-        _tokenizer.Read( RPAREN );
+        std::vector<double> xyz;
+        _tokenizer.ReadTupleList( xyz, NULL, 3 );
+        tmesh->addVertices( xyz );
         _tokenizer.Read( SEMICOLON );
         break;
+      }
 
 
       case RBRACE:
       {
         _tokenizer.Read( RBRACE );
 
+        if( _bakeMeshes )
+          tmesh->bakeTransform( &scene->transformRoot );
+
         // Now add all the faces into the trimesh, since hopefully
         // the vertices have been parsed out
-        for( list<glm::dvec3>::const_iterator vitr = faces.begin(); vitr != faces.end(); vitr++ )
+        tmesh->faces.reserve( faces.size() / 3 );
+        for( size_t f = 0; f + 2 < faces.size(); f += 3 )
         {
-          if( !tmesh->addFace( (*vitr)[0], (*vitr)[1], (*vitr)[2] ) )
+          if( !tmesh->addFace( faces[f], faces[f+1], faces[f+2] ) )
           {
             ostringstream oss;
-            oss << "Bad face in trimesh: (" << (*vitr)[0] << ", " << (*vitr)[1] << 
-              ", " << (*vitr)[2] << ")";
+            oss << "Bad face in trimesh: (" << faces[f] << ", " << faces[f+1] << 
+              ", " << faces[f+2] << ")";
             throw ParserException( oss.str() );
           }
         }
@@ -698,23 +671,38 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
   }
 }
 
-void Parser::parseFaces( list< glm::dvec3 >& faces )
+// Reads the whole faces list and triangulates it into index triples
+void Parser::parseFaces( std::vector<int>& faces )
 {
-  list< double > points = parseScalarList();
+  std::vector<double> indices;
+  std::vector<int> sizes;
+  _tokenizer.ReadTupleList( indices, &sizes, 0 );
+
+  size_t triangles = 0;
+  for( int n : sizes )
+  {
+    if( n < 3 )
+      throw SyntaxErrorException( "Faces must have at least 3 vertices.", _tokenizer );
+    triangles += n - 2;
+  }
+  faces.reserve( faces.size() + 3 * triangles );
 
   // triangulate here and now.  assume the poly is
   // concave (convex?) and we can triangulate using an arbitrary fan
-  if( points.size() < 3 )
-     throw SyntaxErrorException( "Faces must have at least 3 vertices.", _tokenizer );
-
-  list<double>::const_iterator i = points.begin();
-  double a = (*i++);
-  double b = (*i++);
-  while( i != points.end() )
+  const double* i = indices.data();
+  for( int n : sizes )
   {
-    double c = (*i++);
-    faces.push_back( glm::dvec3( a, b, c ) );
-    b = c;
+    int a = (int)i[0];
+    int b = (int)i[1];
+    for( int k = 2; k < n; k++ )
+    {
+      int c = (int)i[k];
+      faces.push_back( a );
+      faces.push_back( b );
+      faces.push_back( c );
+      b = c;
+    }
+    i += n;
   }
 }
 
@@ -900,16 +888,16 @@ string Parser::parseIdentExpression()
 
 double Parser::parseScalar()
 {
-  unique_ptr<Token> scalar( _tokenizer.Read( SCALAR ) );
+  Token scalar( _tokenizer.Read( SCALAR ) );
 
-  return scalar->value();
+  return scalar.value();
 }
 
 string Parser::parseIdent()
 {
-  unique_ptr<Token> scalar( _tokenizer.Read( IDENT ) );
+  Token scalar( _tokenizer.Read( IDENT ) );
 
-  return scalar->ident();
+  return scalar.ident();
 }
 
 
@@ -955,34 +943,34 @@ bool Parser::parseBoolean()
 glm::dvec3 Parser::parseVec3d()
 {
   _tokenizer.Read( LPAREN );
-  unique_ptr<Token> value1( _tokenizer.Read( SCALAR ) );
+  Token value1( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  unique_ptr<Token> value2( _tokenizer.Read( SCALAR ) );
+  Token value2( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  unique_ptr<Token> value3( _tokenizer.Read( SCALAR ) );
+  Token value3( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( RPAREN );
 
-  return glm::dvec3( value1->value(), 
-    value2->value(), 
-    value3->value() );
+  return glm::dvec3( value1.value(), 
+    value2.value(), 
+    value3.value() );
 }
 
 glm::dvec4 Parser::parseVec4d()
 {
   _tokenizer.Read( LPAREN );
-  unique_ptr<Token> value1( _tokenizer.Read( SCALAR ) );
+  Token value1( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  unique_ptr<Token> value2( _tokenizer.Read( SCALAR ) );
+  Token value2( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  unique_ptr<Token> value3( _tokenizer.Read( SCALAR ) );
+  Token value3( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( COMMA );
-  unique_ptr<Token> value4( _tokenizer.Read( SCALAR ) );
+  Token value4( _tokenizer.Read( SCALAR ) );
   _tokenizer.Read( RPAREN );
 
-  return glm::dvec4( value1->value(), 
-    value2->value(), 
-    value3->value(),
-    value4->value() );
+  return glm::dvec4( value1.value(), 
+    value2.value(), 
+    value3.value(),
+    value4.value() );
 }
 
 Material* Parser::parseMaterial( Scene* scene, const Material& parent )
@@ -1045,7 +1033,7 @@ Material* Parser::parseMaterial( Scene* scene, const Material& parent )
 
       case NAME:
          _tokenizer.Read(NAME);
-         name = (_tokenizer.Read(IDENT))->ident();
+         name = _tokenizer.Read(IDENT).ident();
          _tokenizer.Read( SEMICOLON );
          break;
 
@@ -43,12 +43,16 @@ class Parser
     // We need the path for referencing files from the
     // base file.
     Parser( Tokenizer& tokenizer, string basePath )
-      : _tokenizer( tokenizer ), _basePath( basePath )
+      : _tokenizer( tokenizer ), _basePath( basePath ), _bakeMeshes( false )
       { }
 
     // Parse the top-level scene
     Scene* parseScene();
 
+    // Move each trimesh's vertices and normals into world space as it
+    // is read, so its faces need no per-ray transform.
+    void setBakeMeshes( bool bake ) { _bakeMeshes = bake; }
+
 private:
 
     // Highest level parsing routines
@@ -71,7 +75,7 @@ private:
     void      parseCylinder(Scene* scene, TransformNode* transform, const Material& mat);
     void      parseCone(Scene* scene, TransformNode* transform, const Material& mat);
     void      parseTrimesh(Scene* scene, TransformNode* transform, const Material& mat);
-    void      parseFaces( std::list< glm::dvec3 >& faces );
+    void      parseFaces( std::vector<int>& faces );
 
     // Parse transforms
     void parseTranslate(Scene* scene, TransformNode* transform, const Material& mat);
@@ -106,6 +110,7 @@ private:
     Tokenizer& _tokenizer;
     mmap materials;
     std::string _basePath;
+    bool _bakeMeshes;
 };
 
 #endif
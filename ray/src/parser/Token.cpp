@@ -179,7 +179,13 @@ SYMBOL lookupReservedWord(const string& ident) {
 
 string Token::toString() const
 {
-  return getNameForToken( kind() );
+  ostringstream oss;
+  oss << getNameForToken( kind() );
+  if( IDENT == kind() )
+    oss << ": \"" << _ident << "\"";
+  else if( SCALAR == kind() )
+    oss << ": " << _value;
+  return oss.str();
 }
 
 void Token::Print( ostream& out ) const {
@@ -189,16 +195,3 @@ void Token::Print( ostream& out ) const {
 void Token::Print( ) const {
   Print( std::cout );
 }
-
-string IdentToken::toString( ) const {
-  ostringstream oss( Token::toString() );
-  oss << ": \"" << _ident << "\"";
-  return oss.str();
-}
-
-string ScalarToken::toString( ) const {
-  ostringstream oss( Token::toString() );
-  oss << ": " << _value;
-  return oss.str();
-}
- 
@@ -88,53 +88,46 @@ enum SYMBOL {
 string getNameForToken( const SYMBOL kind );
 SYMBOL lookupReservedWord( const string& name );
 
+/* Tokens are small values rather than a class hierarchy: the
+   tokenizer hands them out by value, so scanning a large mesh
+   doesn't allocate one object per number.  Only identifiers carry
+   a string, and it's usually short enough to live inside it.
+*/
 class Token {
   public:
-    Token(SYMBOL kind) : _kind( kind ) { }
+    Token() : _kind( UNKNOWN ), _value( 0.0 ) { }
+    Token(SYMBOL kind) : _kind( kind ), _value( 0.0 ) { }
+    Token(SYMBOL kind, double value) : _kind( kind ), _value( value ) { }
+    Token(SYMBOL kind, std::string ident)
+      : _kind( kind ), _value( 0.0 ), _ident( std::move( ident ) ) { }
 
     SYMBOL kind() const { return _kind; }
 
     // Note that these errors should not ever be encountered at runtime,
     // and signify parser bugs of some kind.
-    virtual std::string ident() const   
-      { throw ParserFatalException("not an IdentToken"); return std::string(); }
-    virtual double value() const   
-      { throw ParserFatalException("not a ScalarToken"); return 0.0; }
-
-
-    // Utility functions
-    virtual void Print(std::ostream& out) const;
-    virtual void Print() const;
-    virtual string toString() const;
-
-	virtual ~Token() {}
-  protected:
-    const SYMBOL _kind;
-};
-
-class IdentToken : public Token {
-  public:
-    IdentToken(std::string ident) : Token(IDENT), _ident( ident ) { 
+    const std::string& ident() const
+    {
+      if( _kind != IDENT )
+        throw ParserFatalException("not an IdentToken");
+      return _ident;
+    }
+    double value() const
+    {
+      if( _kind != SCALAR )
+        throw ParserFatalException("not a ScalarToken");
+      return _value;
     }
 
-    std::string ident() const { return _ident; }
-
-    string toString() const;
-
-  protected:
-    const std::string _ident;
-};
-
-class ScalarToken : public Token {
-  public:
-    ScalarToken(double value) : Token(SCALAR), _value( value ) { }
-    
-    double value() const { return _value; }
 
+    // Utility functions
+    void Print(std::ostream& out) const;
+    void Print() const;
     string toString() const;
 
   protected:
-    const double _value;
+    SYMBOL _kind;
+    double _value;
+    std::string _ident;
 };
 
 
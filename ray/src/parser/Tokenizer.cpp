@@ -3,9 +3,10 @@
 #include <string> 
 #include <map>
 #include <sstream>
+#include <algorithm>
 #include <stdlib.h>
+#include <stdint.h>
 
-#include "../fileio/buffer.h"
 #include "Tokenizer.h"
 #include "Token.h"
 
@@ -24,24 +25,27 @@
 */
 
 
+// Character classes, without the locale lookups of <cctype>; the
+// .ray format is plain ASCII.
+static inline bool IsDigit(char c) { return (unsigned char)(c - '0') < 10; }
+static inline bool IsAlpha(char c) { return (unsigned char)((c | 0x20) - 'a') < 26; }
+static inline bool IsSpace(char c) { return ' ' == c || (unsigned char)(c - '\t') < 5; }
+
 //////////////////////////////////////////////////////////////////////////
 //
-// Tokenizer::Tokenizer(istream&) constructor
+// Tokenizer::Tokenizer(const char*, size_t) constructor
 //
-//   This constructor sets up the initial state that we need in order
-// to start scanning.  Note that we will be passed an OPEN file.  This
-// simplifies the scanner part, since we don't have to open it and
-// error check to see if it exists.  We assume that the caller (which
-// will be the main() function) sets up everything and passes us a VALID
-// file pointer.
+//   Scans text that the caller keeps alive, such as a file it has
+// mapped.
 //
 
-Tokenizer::Tokenizer(istream& fp, bool printTokens) 
-  : buffer( fp, false, false )
-{ 
-    TokenColumn = 0;
-    CurrentCh = ' ';
-    UnGetToken = NULL;
+Tokenizer::Tokenizer(const char* text, size_t length, bool printTokens)
+{
+    begin = text;
+    end = text + length;
+    cur = begin;
+    TokenStart = begin;
+    hasPeeked = false;
     _printTokens = printTokens;
 }
 
@@ -51,77 +55,66 @@ Tokenizer::Tokenizer(istream& fp, bool printTokens)
 // last phase to be executed
 // 
 void Tokenizer::ScanProgram() {
-    while (Get()->kind() != EOFSYM) ;
-}
-
-
-unique_ptr<Token> Tokenizer::Get() {
-  return unique_ptr<Token>(GetNext());
+    while (Get().kind() != EOFSYM) ;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Get() method
+// Token Tokenizer::Get() method
 //
 // Advance through the source to find the next token. Returns peeked token,
 // if there is one.
 //
 
-Token* Tokenizer::GetNext() {
-  Token* T = NULL;
-
-  // First check to see if there is an UnGetToken. If there is, use it.
-  if (UnGetToken != NULL) {
-    T = UnGetToken;
-    UnGetToken = NULL;
-    return T;
+Token Tokenizer::Get() {
+  if (hasPeeked) {
+    hasPeeked = false;
+    return std::move(peeked);
   }
+  Token T;
+  GetNext(T);
+  return T;
+}
 
-  // Otherwise, crank up the scanner and get a new token.
-
+void Tokenizer::GetNext(Token& T) {
   // Get rid of any whitespace
   SkipWhiteSpace();
 
+  // Save the starting position of the symbol, so that nicer
+  // error messages can be produced.
+  TokenStart = cur;
+
   // test for end of file
-  if (buffer.isEOF()) {
-    T = new Token(EOFSYM);
+  if (cur == end) {
+    T = Token(EOFSYM);
 
   } else {
-    
-    // Save the starting position of the symbol in a variable,
-    // so that nicer error messages can be produced.
-    TokenColumn = buffer.CurColumn();
-    
+    char c = *cur;
+
     // Check kind of current character
-    
+
     // Note that _'s are now allowed in identifiers.
-    if (isalpha(CurrentCh) || '_' == CurrentCh) {
+    if (IsAlpha(c) || '_' == c) {
       // grab identifier or reserved word
-      T = GetIdent();
-    } else if ( '"' == CurrentCh)  {
-      T = GetQuotedIdent(); 
-    } else if (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh) {
-      T = GetScalar();
-    } else { 
+      GetIdent(T);
+    } else if ( '"' == c)  {
+      GetQuotedIdent(T);
+    } else if (IsDigit(c) || '-' == c || '.' == c) {
+      GetScalar(T);
+    } else {
       //
       // Check for other tokens
       //
-      
-      T = GetPunct();
+
+      GetPunct(T);
     }
   }
-  
-  if (T == NULL) {
-    throw ParserFatalException("didn't get a token");
-  }
 
   if (_printTokens) {
     std::cout << "Token read: ";
-    T->Print();
+    T.Print();
     std::cout << std::endl;
   }
-
-  return T;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -129,180 +122,303 @@ Token* Tokenizer::GetNext() {
 // Skips spaces, tabs, newlines, and comments
 //
 void Tokenizer::SkipWhiteSpace() {
-  while (isspace(CurrentCh)) {
-    GetCh();
-  }
+  for (;;) {
+    while (cur != end && IsSpace(*cur))
+      ++cur;
+
+    if (cur == end || '/' != *cur)
+      return;
 
-  if( '/' == CurrentCh )  // Look for comments
-  {
-    GetCh();
-    if( '/' == CurrentCh )
-    {
+    // Look for comments
+    const char* slash = cur++;
+    if (cur != end && '/' == *cur) {
       // Throw out everything until the end of the line
-      while( '\n' != CurrentCh )
-      {
-        GetCh();
-      }
-    }
-    else if ( '*' == CurrentCh )
-    {
+      while (cur != end && '\n' != *cur)
+        ++cur;
+    } else if (cur != end && '*' == *cur) {
+      TokenStart = slash;
       int startLine = CurLine();
-      while( true )
-      {
-        GetCh();
-        if( '*' == CurrentCh )
-        {
-          GetCh();
-          if( CondReadCh( '/' ) )
-            break;
-          else if ( buffer.isEOF() )
-          {
-            std::ostringstream ost;
-            ost << "Unterminated comment in line ";
-            ost << startLine;
-            throw SyntaxErrorException( ost.str(), *this );
-          }
-        }
-        else if ( buffer.isEOF() )
-        {
-          std::ostringstream ost;
-          ost << "Unterminated comment in line ";
-          ost << startLine;
-          throw SyntaxErrorException( ost.str(), *this );
-        }
+      const char* close = std::search(cur + 1, end, "*/", "*/" + 2);
+      if (close == end) {
+        TokenStart = end;
+        std::ostringstream ost;
+        ost << "Unterminated comment in line ";
+        ost << startLine;
+        throw SyntaxErrorException( ost.str(), *this );
       }
-    }
-    else
-    {
+      cur = close + 2;
+    } else {
+      TokenStart = cur;
       std::ostringstream ost;
-      ost << "unexpected character: '" << CurrentCh << "'";
-	  throw SyntaxErrorException( ost.str(), *this );
+      ost << "unexpected character: '" << (cur != end ? *cur : '\0') << "'";
+      throw SyntaxErrorException( ost.str(), *this );
     }
-
-    SkipWhiteSpace();  // We may need to throw out
-                       //  more white space/comments
-                       // This is admittedly tail recursion...
   }
 }
 
-Token* Tokenizer::GetQuotedIdent() {
-  GetCh();   // Throw out beginning '"'
+void Tokenizer::GetQuotedIdent(Token& T) {
+  const char* first = ++cur;   // Throw out beginning '"'
 
-  std::ostringstream ident;
-  while ( '"' != CurrentCh ) {
-    if( '\n' == CurrentCh )
-      throw SyntaxErrorException( "Unterminated string constant", *this );
-
-    ident << CurrentCh;
-    GetCh();
+  while (cur != end && '"' != *cur) {
+    if( '\n' == *cur )
+      break;
+    ++cur;
+  }
+  if (cur == end || '"' != *cur) {
+    TokenStart = cur;
+    throw SyntaxErrorException( "Unterminated string constant", *this );
   }
-  GetCh();
-  return new IdentToken( ident.str() );
+  T = Token( IDENT, string( first, cur ) );
+  ++cur;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetIdent method
+// Tokenizer::GetIdent method
 //
 //   GetIdent scans an identifier-like token.  It returns an
 //   identifier or a reserved word token.
 //
 
-Token* Tokenizer::GetIdent() {
+void Tokenizer::GetIdent(Token& T) {
   // an IDENTIFIER or a RESERVED WORD token
-  std::ostringstream ident;
-  while (isalnum(CurrentCh) || '_' == CurrentCh || '-' == CurrentCh) { 
-    // While we still have something that can
-    ident << CurrentCh;
-    GetCh();
-  }
-  return SearchReserved(ident.str());
+  const char* first = cur;
+  while (cur != end && (IsAlpha(*cur) || IsDigit(*cur) || '_' == *cur || '-' == *cur))
+    ++cur;
+
+  string ident( first, cur );
+  SYMBOL tokSymbol = lookupReservedWord( ident );
+  if( UNKNOWN == tokSymbol )
+    T = Token( IDENT, std::move( ident ) );
+  else
+    T = Token( tokSymbol );
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetInt method
+// Tokenizer::GetScalar method
 //
-//   GetInt scans an integer.  It returns an integer token.
+//   GetScalar scans a number.  The characters are gathered greedily
+//   and must convert to exactly what atof() gives for them; numbers
+//   that fit the fast path below are converted without it.
 //
 
-Token* Tokenizer::GetScalar() {
-  // an INTEGER token
-  string ret( "" );
-  while (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh || 'e' == CurrentCh ) {
-    ret += CurrentCh;
-    GetCh();
+// Plain decimals with at most 15 significant digits and a small
+// exponent are exact in a double, so one multiply or divide by an
+// exact power of ten rounds correctly; anything else goes to strtod.
+static bool FastDecimal(const char* p, const char* e, double& result)
+{
+  static const double pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  bool negative = false;
+  if (p != e && '-' == *p) {
+    negative = true;
+    ++p;
+  }
+
+  uint64_t mantissa = 0;
+  int significant = 0;
+  int exponent = 0;
+  bool anyDigits = false;
+
+  for (; p != e && IsDigit(*p); ++p) {
+    anyDigits = true;
+    if (mantissa != 0 || *p != '0')
+      ++significant;
+    mantissa = mantissa * 10 + (*p - '0');
+  }
+  if (p != e && '.' == *p) {
+    for (++p; p != e && IsDigit(*p); ++p) {
+      anyDigits = true;
+      if (mantissa != 0 || *p != '0')
+        ++significant;
+      mantissa = mantissa * 10 + (*p - '0');
+      --exponent;
+    }
+  }
+  if (!anyDigits || significant > 15)
+    return false;
+
+  if (p != e && 'e' == *p) {
+    const char* q = p + 1;
+    bool negExp = false;
+    if (q != e && '-' == *q) {
+      negExp = true;
+      ++q;
+    }
+    if (q == e || !IsDigit(*q))
+      return false;
+    int exp = 0;
+    for (; q != e && IsDigit(*q); ++q) {
+      if (exp > 1000)
+        return false;
+      exp = exp * 10 + (*q - '0');
+    }
+    exponent += negExp ? -exp : exp;
+    p = q;
   }
-  return new ScalarToken( atof( ret.c_str() ) );
+  // atof would stop early at whatever is left; let it decide
+  if (p != e)
+    return false;
+
+  double value = (double)mantissa;
+  if (exponent < -22 || exponent > 22)
+    return false;
+  value = exponent < 0 ? value / pow10[-exponent] : value * pow10[exponent];
+  result = negative ? -value : value;
+  return true;
+}
+
+double Tokenizer::ScanNumber() {
+  const char* first = cur;
+  while (cur != end && (IsDigit(*cur) || '-' == *cur || '.' == *cur || 'e' == *cur))
+    ++cur;
+
+  double value;
+  if (!FastDecimal(first, cur, value))
+    value = atof( string( first, cur ).c_str() );
+  return value;
+}
+
+void Tokenizer::GetScalar(Token& T) {
+  T = Token( SCALAR, ScanNumber() );
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetPunct() method
+// void Tokenizer::ReadTupleList() method
 //
-//   Gets a punctuation token from input stream and returns it.
+//   Reads a whole list of scalar tuples, such as the points of a
+//   trimesh:
+//
+//     ( (x, y, z), (x, y, z), ... )
+//
+//   straight from the text into values, without making a Token for
+//   each number and punctuation mark.  If sizes is NULL every tuple
+//   must have exactly arity scalars; otherwise tuples may be any
+//   length and the length of each is appended to sizes.  Errors are
+//   reported just as the token-by-token parse would.  Tokens read
+//   this way are not echoed by the printTokens flag.
 //
 
-Token* Tokenizer::GetPunct() {
-  Token* T;
+void Tokenizer::ReadTupleList(std::vector<double>& values, std::vector<int>* sizes, int arity) {
+  if (hasPeeked)
+    throw ParserFatalException("ReadTupleList called after Peek");
 
-  switch (CurrentCh) {
-  case '(':  GetCh(); T = new Token(LPAREN);     break;
-  case ')':  GetCh(); T = new Token(RPAREN);     break;
-  case '{':  GetCh(); T = new Token(LBRACE);     break;
-  case '}':  GetCh(); T = new Token(RBRACE);     break;
-  case ',':  GetCh(); T = new Token(COMMA);      break;
-  case '=':  GetCh(); T = new Token(EQUALS);     break;
-  case ';':  GetCh(); T = new Token(SEMICOLON);  break;
+  ExpectCh( '(', LPAREN );
 
-  default:
-    std::ostringstream ost;
-    ost << "unexpected character: '" << CurrentCh << "'";
-    throw SyntaxErrorException(ost.str(), *this);
+  // Every tuple opens with a paren and the list ends at the next
+  // semicolon, which gives a cheap estimate of how much room to make.
+  const char* stop = std::find( cur, end, ';' );
+  size_t tuples = std::count( cur, stop, '(' );
+  values.reserve( values.size() + tuples * std::max( arity, 3 ) );
+  if (sizes)
+    sizes->reserve( sizes->size() + tuples );
+
+  SkipWhiteSpace();
+  if (cur != end && ')' == *cur) {
+    ++cur;
+    return;
   }
 
-  return T;
+  for (;;) {
+    ExpectCh( '(', LPAREN );
+    int n = 0;
+    for (;;) {
+      SkipWhiteSpace();
+      if (sizes && 0 == n && cur != end && ')' == *cur)
+        break;
+      TokenStart = cur;
+      if (cur == end || !(IsDigit(*cur) || '-' == *cur || '.' == *cur))
+        throw SyntaxErrorException( getNameForToken( SCALAR ) + " expected", *this );
+      values.push_back( ScanNumber() );
+      ++n;
+
+      if (!sizes && n == arity)
+        break;
+      SkipWhiteSpace();
+      if (sizes && cur != end && ')' == *cur)
+        break;
+      ExpectCh( ',', COMMA );
+    }
+    ExpectCh( ')', RPAREN );
+    if (sizes)
+      sizes->push_back( n );
+
+    SkipWhiteSpace();
+    if (cur != end && ')' == *cur)
+      break;
+    ExpectCh( ',', COMMA );
+  }
+  ++cur;
+}
+
+// consume the single-character token c, or complain that kind was expected
+void Tokenizer::ExpectCh(char c, SYMBOL kind) {
+  SkipWhiteSpace();
+  TokenStart = cur;
+  if (cur == end || c != *cur) {
+    string msg( getNameForToken( kind ) );
+    msg.append( " expected" );
+    throw SyntaxErrorException( msg, *this );
+  }
+  ++cur;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// void Tokenizer::UnGet(Token*) method
+// Tokenizer::GetPunct() method
+//
+//   Gets a punctuation token from input stream and returns it.
 //
-//   UnGet returns the last read token to the input, where it will be
-//   returned for the next Get call.  At most 1 token can be pushed back
-//   at a time this way and this token is pointed to by the pointer
-//   TokenToUnGet.  TokenToUnGet must be non null.
 
-void Tokenizer::UnGet(Token* TokenToUnGet) {
-  if (UnGetToken != NULL) {
-    throw ParserFatalException("trying to UnGet more than one token");
+void Tokenizer::GetPunct(Token& T) {
+  switch (*cur) {
+  case '(':  T = Token(LPAREN);     break;
+  case ')':  T = Token(RPAREN);     break;
+  case '{':  T = Token(LBRACE);     break;
+  case '}':  T = Token(RBRACE);     break;
+  case ',':  T = Token(COMMA);      break;
+  case '=':  T = Token(EQUALS);     break;
+  case ';':  T = Token(SEMICOLON);  break;
+
+  default:
+    std::ostringstream ost;
+    ost << "unexpected character: '" << *cur << "'";
+    throw SyntaxErrorException(ost.str(), *this);
   }
-  UnGetToken = TokenToUnGet;
+  ++cur;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Peek() method
+// const Token* Tokenizer::Peek() method
 //
-//   Peek reads the next token and pushes it back on the token stream
+//   Peek reads the next token and pushes it back on the token stream.
+//   At most one token is held back this way.
 //
 
 const Token* Tokenizer::Peek() {
-  Token* T = GetNext();
-  UnGet(T);
-  return T;
+  if (!hasPeeked) {
+    GetNext(peeked);
+    hasPeeked = true;
+  }
+  return &peeked;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Read(SYMBOL) method
+// Token Tokenizer::Read(SYMBOL) method
 //
 //   Read gets the next token and checks that it's of the expected type.
 //
 
-unique_ptr<Token> Tokenizer::Read(SYMBOL kind) {
-  unique_ptr<Token> T( Get() );
-  if (T->kind() != kind) {
+Token Tokenizer::Read(SYMBOL kind) {
+  Token T( Get() );
+  if (T.kind() != kind) {
     string msg( getNameForToken( kind ) );
     msg.append( " expected" );
     throw SyntaxErrorException(msg, *this);
@@ -320,9 +436,8 @@ unique_ptr<Token> Tokenizer::Read(SYMBOL kind) {
 //
 
 bool Tokenizer::CondRead(SYMBOL kind) {
-  const Token* T = Peek();
-  if (T->kind() == kind) {
-    Get( );
+  if (Peek()->kind() == kind) {
+    hasPeeked = false;
     return true;
   } else {
     return false;
@@ -331,46 +446,30 @@ bool Tokenizer::CondRead(SYMBOL kind) {
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::SearchReserved(const string&) private method
+// Position tracking
 //
-//   SearchReserved() maps a character string to an IdentToken or one of
-// several possible reserved word tokens, using a binary search on the
-// ReservedWords structure.
+//   Only error messages need line and column numbers, so rather than
+// counting them for every character they are worked out here from
+// where the last token started.  Lines count from 1, columns from 0.
 //
 
-//
-// The list of all the Reserved words and their associated symbols,
-// in alphabetical order so this can be searched using binary search.
-//
-
-typedef std::map<string, SYMBOL> ReservedWordsMap;
+const char* Tokenizer::LineStart() const {
+  const char* p = TokenStart;
+  while (p != begin && '\n' != p[-1])
+    --p;
+  return p;
+}
 
-Token* Tokenizer::SearchReserved(const string& ident) const {
-  SYMBOL tokSymbol = lookupReservedWord( ident );
-  if( UNKNOWN == tokSymbol )
-  {
-    return new IdentToken( ident );
-  }
-  else
-  {
-    return new Token( tokSymbol );
-  }
+int Tokenizer::CurLine() const {
+  return 1 + (int)std::count(begin, TokenStart, '\n');
 }
 
-//////////////////////////////////////////////////////////////////////////
-//
-// bool Tokenizer::CondReadCh(char) private method
-//
-//   CondReadCh checks to see if the CurrentCh is the same as the argument.
-// If so, CondReadCh eats that character (by calling GetCh())
-// and returns true.  If not, just return false.
-//
+int Tokenizer::CurColumn() const {
+  return (int)(TokenStart - LineStart());
+}
 
-bool Tokenizer::CondReadCh(char c) {
-  if (c == CurrentCh) {
-    GetCh();
-    return true;
-  } else {
-    return false;
-  }
+void Tokenizer::PrintLine( ostream& out ) const {
+  const char* first = LineStart();
+  const char* last = std::find(TokenStart, end, '\n');
+  out << "# " << string( first, last ) << "\n" << std::endl;
 }
@@ -3,10 +3,10 @@
 #define __TOKENIZER_H__
 
 #include "Token.h"
-#include "../fileio/buffer.h"
 
 #include <string>
 #include <memory>
+#include <vector>
 
 // Needed to correct for annoying "feature" in MSVC's compiler
 #pragma warning (disable: 4786)
@@ -27,31 +27,46 @@ using std::unique_ptr;
    PL0 project used for CSE401
    (http://www.cs.washington.edu/401).
 
+   The scanner works directly on the text of the whole file, which
+   the caller has in memory (RayTracer::readScene maps it), rather
+   than pulling characters through an istream, and tokens are plain
+   values.
+   Line and column numbers are only needed for error messages,
+   so they are worked out from the token's offset when asked.
+
 */
 
 class Tokenizer {
   public:
-    Tokenizer(istream& fp, bool printTokens);
+    // scan text owned by the caller, which must outlive the tokenizer
+    Tokenizer(const char* text, size_t length, bool printTokens);
 
     // destructively read & return the next token, skipping over whitespace
-    unique_ptr<Token> Get();
+    Token Get();
 
-    // non-destructively get the next token, pushing it back to be read again
+    // non-destructively get the next token, pushing it back to be read again.
+    // The pointer is only good until the next token is read.
     const Token* Peek();
 
     // Get() the next token, and check that it's of the expected SYMBOL type
-    unique_ptr<Token> Read(SYMBOL expected);
+    Token Read(SYMBOL expected);
 
     // read the next token only if it matches the expected token type.
     // Return whether it matches.
     bool CondRead(SYMBOL expected);
 
+    // Read a list of scalar tuples, ( (a, b, c), (d, e, f), ... ), in
+    // one go, appending the scalars to values.  With sizes == NULL each
+    // tuple must hold exactly arity scalars; otherwise any number, and
+    // each tuple's length is appended to sizes.  Must not follow a Peek().
+    void ReadTupleList(std::vector<double>& values, std::vector<int>* sizes, int arity);
+
     // display the current source line onto the screen.
-    void PrintLine( ostream& out) const { buffer.PrintLine(out); }
+    void PrintLine( ostream& out) const;
 
     // return the column number/line number of the current token.
-    int CurColumn() const { return TokenColumn; }
-    int CurLine() const { return buffer.CurLine(); }
+    int CurColumn() const;
+    int CurLine() const;
 
     // Repeatedly scan tokens and throw them away.  Useful if this is the
     // last phase to be executed
@@ -60,32 +75,30 @@ class Tokenizer {
 protected:
     // private methods:
 
-    // push the argument token back onto the scanner's token stream;
-    // it will be returned by the next Get/Peek/Read/CondRead call
-    Token* GetNext();
-    void UnGet(Token* t);
-
-    Token* SearchReserved(const string&) const; // Convert ident string into token
+    void GetNext(Token& t);
 
-    void GetCh() { CurrentCh = buffer.GetCh(); }
-    bool CondReadCh(char expected);        // consume a character, if it matches
+    void SkipWhiteSpace();        // skip spaces, tabs, newlines, comments
 
-    void SkipWhiteSpace();        // skip spaces, tabs, newlines
+    void GetPunct(Token& t);      // scan punctuation token
+    void GetScalar(Token& t);     // scan number token
+    double ScanNumber();          // scan a number's characters and convert them
+    void ExpectCh(char c, SYMBOL kind); // consume punctuation c, or throw
+    void GetIdent(Token& t);      // scan identifier token
+    void GetQuotedIdent(Token& t);
 
-    Token* GetPunct();            // scan punctuation token
-    Token* GetScalar();           // scan integer token
-    Token* GetIdent();            // scan identifier token
-    Token* GetQuotedIdent();
+    const char* LineStart() const; // start of the line holding TokenStart
 
 
     // private data:
 
-    Buffer buffer;                // The file buffer
-    char CurrentCh;               // The current character in the current line
+    const char* begin;            // the text being scanned
+    const char* end;
+    const char* cur;              // the next unread character
 
-    Token* UnGetToken;            // The token that has been "ungot"
+    Token peeked;                 // the token that has been pushed back
+    bool hasPeeked;
 
-    int TokenColumn;              // The column where the last read token starts,
+    const char* TokenStart;       // where the last read token starts,
                                   // for generating error messages
 
     bool _printTokens;            // printing flag
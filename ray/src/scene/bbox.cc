@@ -31,15 +31,22 @@ bool BoundingBox::intersects(const glm::dvec3& point) const
 }
 
 bool BoundingBox::intersect(const ray& r, double& tMin, double& tMax) const
+{
+	return intersect(r, tMin, tMax, 1.0e308); // 1.0e308 is close to
+	                                          // infinity... close enough
+	                                          // for us!
+}
+
+bool BoundingBox::intersect(const ray& r, double& tMin, double& tMax,
+                            double tLimit) const
 {
 	/*
  	 * Kay/Kajiya algorithm.
 	 */
 	glm::dvec3 R0 = r.getPosition();
 	glm::dvec3 Rd = r.getDirection();
-	tMin = -1.0e308; // 1.0e308 is close to infinity... close enough
-	                 // for us!
-	tMax = 1.0e308;
+	tMin = -1.0e308;
+	tMax = tLimit;
 	double ttemp;
 
 	for (int currentaxis = 0; currentaxis < 3; currentaxis++) {
@@ -60,6 +60,10 @@ public:
 	// intersection
 	// in tMax and return true, else return false.
 	bool intersect(const ray& r, double& tMin, double& tMax) const;
+	// The same, but the ray stops at tLimit: a box it only reaches
+	// further on counts as missed.
+	bool intersect(const ray& r, double& tMin, double& tMax,
+	               double tLimit) const;
 
 	void operator=(const BoundingBox& target);
 	double area();
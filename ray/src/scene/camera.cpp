@@ -83,6 +83,12 @@ Camera::setFOV(double fov)
     update();
 }
 
+double
+Camera::getFOV() const
+{
+    return 2 * atan(normalizedHeight / 2) * (180.0 / PI);
+}
+
 void
 Camera::setAspectRatio(double ar)
 // ar - ratio of width to height
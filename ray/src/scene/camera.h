@@ -7,6 +7,7 @@
 
 class Camera
 {
+    friend class SceneCache;
 public:
     Camera();
     void rayThrough( double x, double y, ray &r );
@@ -17,6 +18,7 @@ public:
     void setAspectRatio( double );
 
     double getAspectRatio() { return aspectRatio; }
+    double getFOV() const;	// in degrees, as given to setFOV
 
 	const glm::dvec3& getEye() const			{ return eye; }
 	const glm::dvec3& getLook() const		{ return look; }
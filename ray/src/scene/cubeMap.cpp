@@ -2,21 +2,23 @@
 #include "ray.h"
 #include "../ui/TraceUI.h"
 #include "../scene/material.h"
+#include <algorithm>
+#include <cmath>
 extern TraceUI* traceUI;
 
-glm::dvec3 CubeMap::getColor(ray r) const
-{
-	// YOUR CODE HERE
-	// FIXME: Implement Cube Map here
+namespace {
 
-	double x = r.getDirection()[0];
-	double y = r.getDirection()[1];
-	double z = r.getDirection()[2];
+// Pick the face a direction points at and its [0, 1] face coordinates.
+int directionToFace(const glm::dvec3& d, double& u, double& v)
+{
+	double x = d[0];
+	double y = d[1];
+	double z = d[2];
 	double absValX = glm::abs(x);
 	double absValY = glm::abs(y);
 	double absValZ = glm::abs(z);
 	int index;
-	double k, u, v;
+	double k;
 
 	if (absValX > absValY && absValX > absValZ) {
 		k = absValX;
@@ -62,11 +64,168 @@ glm::dvec3 CubeMap::getColor(ray r) const
 	} 
 	u = 0.5 * (u / k + 1);
 	v = 0.5 * (v / k + 1);
+	return index;
+}
+
+// Inverse of directionToFace; u and v may lie outside [0, 1], in
+// which case the direction points into a neighbouring face.
+glm::dvec3 faceToDirection(int face, double u, double v)
+{
+	u = 2.0 * u - 1.0;
+	v = 2.0 * v - 1.0;
+	switch (face) {
+		case 0:  return glm::dvec3(1.0, v, -u);
+		case 1:  return glm::dvec3(-1.0, v, u);
+		case 2:  return glm::dvec3(u, 1.0, -v);
+		case 3:  return glm::dvec3(u, -1.0, v);
+		case 4:  return glm::dvec3(u, v, 1.0);
+		default: return glm::dvec3(-u, v, -1.0);
+	}
+}
+
+} // anonymous namespace
+
+// Texel (x, y) of the given level of a face.  Coordinates past the
+// edge are wrapped onto the adjacent face so filters cross seams.
+const float* CubeMap::fetch(const std::vector<MipLevel>* src, int level,
+                            int face, int x, int y) const
+{
+	const MipLevel& l = src[face][level];
+	if (x >= 0 && y >= 0 && x < l.width && y < l.height)
+		return l.at(x, y);
+
+	double u, v;
+	int f = directionToFace(faceToDirection(face, (x + 0.5) / l.width,
+	                                        (y + 0.5) / l.height), u, v);
+	const MipLevel& o = src[f][std::min(level, (int)src[f].size() - 1)];
+	return o.at(glm::clamp((int)(u * o.width), 0, o.width - 1),
+	            glm::clamp((int)(v * o.height), 0, o.height - 1));
+}
+
+glm::dvec3 CubeMap::bilinear(int level, int face, double u, double v) const
+{
+	const MipLevel& l = faces[face][level];
+	double x = u * l.width - 0.5;
+	double y = v * l.height - 0.5;
+	double fx = floor(x);
+	double fy = floor(y);
+	double wx = x - fx;
+	double wy = y - fy;
+
+	const float* t00 = fetch(faces, level, face, (int)fx, (int)fy);
+	const float* t10 = fetch(faces, level, face, (int)fx + 1, (int)fy);
+	const float* t01 = fetch(faces, level, face, (int)fx, (int)fy + 1);
+	const float* t11 = fetch(faces, level, face, (int)fx + 1, (int)fy + 1);
+
+	glm::dvec3 ret;
+	for (int c = 0; c < 3; ++c) {
+		double top = t00[c] + wx * (t10[c] - t00[c]);
+		double bottom = t01[c] + wx * (t11[c] - t01[c]);
+		ret[c] = top + wy * (bottom - top);
+	}
+	return ret;
+}
+
+glm::dvec3 CubeMap::getColor(const ray& r) const
+{
+	double u, v;
+	int index = directionToFace(r.getDirection(), u, v);
+
+	// not prefiltered yet, e.g. a debug ray before the first render
+	if (faces[index].empty())
+		return tMap[index]->getMappedValue(glm::dvec2(u, v));
+
+	// A face spans two units of tangent plane at unit distance, so
+	// the cone spread in radians covers this many texels.
+	int levels = (int)faces[index].size();
+	const MipLevel& base = faces[index][0];
+	double texels = r.getConeSpread() * 0.5 * std::max(base.width, base.height);
+	if (texels <= 1.0)
+		return bilinear(0, index, u, v);
+
+	double lod = std::min(log2(texels), double(levels - 1));
+	int lo = (int)lod;
+	int hi = std::min(lo + 1, levels - 1);
+	double w = lod - lo;
+
+	glm::dvec3 a = bilinear(lo, index, u, v);
+	if (hi == lo || w == 0.0)
+		return a;
+	return a + w * (bilinear(hi, index, u, v) - a);
+}
+
+void CubeMap::prefilter(int filterWidth)
+{
+	filterWidth = std::max(filterWidth, 1);
+	if (filterWidth == filteredWidth && !faces[0].empty())
+		return;
+	for (int n = 0; n < 6; n++) {
+		if (!tMap[n] || !tMap[n]->isLoaded())
+			return;
+	}
+
+	// Separable box blur.  Each pass reads across seams through
+	// fetch(), so the blur wraps around the cube instead of
+	// clamping at face edges.  An even width has no middle texel, so
+	// it takes half of the texel at either end to come out exactly
+	// filterWidth texels wide.
+	int radius = filterWidth / 2;
+	double edge = filterWidth % 2 ? 1.0 : 0.5;
+	std::vector<MipLevel> source[6];
+	std::vector<MipLevel> horizontal[6];
+	for (int n = 0; n < 6; n++) {
+		faces[n].clear();
+		source[n].push_back(tMap[n]->getLevel(0));
+		horizontal[n].push_back(tMap[n]->getLevel(0));
+	}
+
+	if (radius > 0) {
+		double norm = 1.0 / filterWidth;
+		for (int n = 0; n < 6; n++) {
+			MipLevel& dst = horizontal[n][0];
+			for (int y = 0; y < dst.height; ++y) {
+				for (int x = 0; x < dst.width; ++x) {
+					double sum[3] = { 0.0, 0.0, 0.0 };
+					for (int k = -radius; k <= radius; ++k) {
+						const float* t = fetch(source, 0, n, x + k, y);
+						double w = k == -radius || k == radius ? edge : 1.0;
+						for (int c = 0; c < 3; ++c)
+							sum[c] += w * t[c];
+					}
+					float* out = dst.at(x, y);
+					for (int c = 0; c < 3; ++c)
+						out[c] = (float)(sum[c] * norm);
+				}
+			}
+		}
+		for (int n = 0; n < 6; n++) {
+			MipLevel& dst = source[n][0];
+			for (int y = 0; y < dst.height; ++y) {
+				for (int x = 0; x < dst.width; ++x) {
+					double sum[3] = { 0.0, 0.0, 0.0 };
+					for (int k = -radius; k <= radius; ++k) {
+						const float* t = fetch(horizontal, 0, n, x, y + k);
+						double w = k == -radius || k == radius ? edge : 1.0;
+						for (int c = 0; c < 3; ++c)
+							sum[c] += w * t[c];
+					}
+					float* out = dst.at(x, y);
+					for (int c = 0; c < 3; ++c)
+						out[c] = (float)(sum[c] * norm);
+				}
+			}
+		}
+	}
 
-	return tMap[index]->getMappedValue(glm::dvec2(u, v));
+	for (int n = 0; n < 6; n++) {
+		faces[n].push_back(std::move(source[n][0]));
+		while (faces[n].back().width > 1 || faces[n].back().height > 1)
+			faces[n].push_back(faces[n].back().downsample());
+	}
+	filteredWidth = filterWidth;
 }
 
-CubeMap::CubeMap()
+CubeMap::CubeMap() : filteredWidth(0)
 {
 }
 
@@ -74,8 +233,12 @@ CubeMap::~CubeMap()
 {
 }
 
-void CubeMap::setNthMap(int n, TextureMap* m)
+void CubeMap::setNthMap(int n, std::shared_ptr<TextureMap> m)
 {
-	if (m != tMap[n].get())
-		tMap[n].reset(m);
+	if (m != tMap[n]) {
+		tMap[n] = std::move(m);
+		// the filtered faces no longer match
+		for (int k = 0; k < 6; k++)
+			faces[k].clear();
+	}
 }
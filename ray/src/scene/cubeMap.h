@@ -1,38 +1,58 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include <glm/vec3.hpp>
+#include "material.h"
 
-class TextureMap;
 class ray;
 
 class CubeMap {
-	std::unique_ptr<TextureMap> tMap[6];
+	typedef TextureMap::MipLevel MipLevel;
+
+	std::shared_ptr<TextureMap> tMap[6];
+
+	// Prefiltered copies of the faces: level 0 is blurred by the
+	// filter width, the rest are its mip reductions.
+	std::vector<MipLevel> faces[6];
+	int filteredWidth;
 public:
 	CubeMap();
 	~CubeMap();
 
-	void setXposMap(TextureMap* m) {
-		setNthMap(0, m);
+	void setXposMap(std::shared_ptr<TextureMap> m) {
+		setNthMap(0, std::move(m));
 	}
-	void setXnegMap(TextureMap* m) {
-		setNthMap(1, m);
+	void setXnegMap(std::shared_ptr<TextureMap> m) {
+		setNthMap(1, std::move(m));
 	}
-	void setYposMap(TextureMap* m) {
-		setNthMap(2, m);
+	void setYposMap(std::shared_ptr<TextureMap> m) {
+		setNthMap(2, std::move(m));
 	}
-	void setYnegMap(TextureMap* m) {
-		setNthMap(3, m);
+	void setYnegMap(std::shared_ptr<TextureMap> m) {
+		setNthMap(3, std::move(m));
 	}
-	void setZposMap(TextureMap* m) {
-		setNthMap(4, m);
+	void setZposMap(std::shared_ptr<TextureMap> m) {
+		setNthMap(4, std::move(m));
 	}
-	void setZnegMap(TextureMap* m) {
-		setNthMap(5, m);
+	void setZnegMap(std::shared_ptr<TextureMap> m) {
+		setNthMap(5, std::move(m));
 	}
 
-	void setNthMap(int n, TextureMap* m);
+	// Faces are shared with the TextureCache and must be loaded
+	// before prefilter() is called.
+	void setNthMap(int n, std::shared_ptr<TextureMap> m);
+
+	// Blur the faces with a box filterWidth texels wide (1 means
+	// no blur) and build their mip levels.  Does nothing if the
+	// faces were already filtered with this width.  Must be called
+	// before rendering threads start.
+	void prefilter(int filterWidth);
 
-	glm::dvec3 getColor(ray r) const;
+	glm::dvec3 getColor(const ray& r) const;
 
+private:
+	const float* fetch(const std::vector<MipLevel>* src, int level,
+	                   int face, int x, int y) const;
+	glm::dvec3 bilinear(int level, int face, double u, double v) const;
 };
@@ -5,11 +5,21 @@
 
 // Note: you can put kd-tree here
 
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <vector>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <glm/vec3.hpp>
 #include "ray.h"
 #include "scene.h"
 #include "bbox.h"
+#include "../fileio/mappedFile.h"
+#include "../SceneObjects/QuadricBatch.h"
+#include "../SceneObjects/TriangleBatch.h"
 #include <iostream>
 
 using namespace std;
@@ -29,10 +39,11 @@ struct Plane{
     BoundingBox rightBBox; 
 };
 
-// parent node class
+// parent node class.  These nodes only live while a tree is being
+// built; rays go through the flattened KdNode tree.
 class Node {
 public:
-    virtual bool findIntersection(ray& r, isect& i, double& t_min, double& t_max) = 0;
+    virtual ~Node() {}
 };
 
 // split point in the kdtree
@@ -46,44 +57,6 @@ public:
 
     SplitNode(int a, int p, BoundingBox b, Node* l, Node* r) : axis(a), pos(p), bbox(b), left(l), right(r) {}
 
-    // check if ray intersects this node's bbox, return intersect if true
-    bool findIntersection(ray& r, isect& i, double& t_min, double& t_max) {
-        if (!bbox.intersect(r, t_min, t_max))
-            return false;
-        left->findIntersection(r, i, t_min, t_max);
-        right->findIntersection(r, i, t_min, t_max);
-            return i.getT() != 1000.0;
-
-        // find max and min on axis
-        double pos_tmin = r.at(t_min)[axis];
-        double pos_tmax = r.at(t_max)[axis];
-        double pos_min = min(pos_tmin, pos_tmax);
-        double pos_max = max(pos_tmin, pos_tmax);
-
-        // handle near parellel
-        if (r.getDirection()[axis] < RAY_EPSILON && r.getDirection()[axis] > -RAY_EPSILON){
-            pos_min+= 1e-6;
-            pos_max+= 1e-6;
-        }
-
-        if(pos > pos_min && pos > pos_max){
-            // check if hits only left
-            left->findIntersection(r, i, t_min, t_max);
-            return i.getT() != 1000.0;
-        } else if(pos < pos_min && pos < pos_max){
-            // check if hits only right
-            right->findIntersection(r, i, t_min, t_max);
-            return i.getT() != 1000.0;
-        } else {
-            // hits both
-            left->findIntersection(r, i, t_min, t_max);
-            right->findIntersection(r, i, t_min, t_max);
-            return i.getT() != 1000.0;
-        }
-
-        return i.getT() != 1000.0;
-    }
-
     ~SplitNode() {
         delete right;
         delete left;
@@ -97,53 +70,322 @@ class LeafNode : public Node
 public:
 
     std::vector<Geometry*> objList;
-    LeafNode(std::vector<Geometry*> _obj) : objList(_obj) {}
+    BoundingBox bbox;
+    LeafNode(std::vector<Geometry*> _obj, BoundingBox b) : objList(_obj), bbox(b) {}
 
-    // checks for intersection for all objects at this node
-    bool findIntersection(ray& r, isect& i, double& t_min, double& t_max){
-        // loop through all objects
-        for(const auto& obj : objList) {
-			isect cur;
-			if( obj->intersect(r, cur) ) {
-				if(i.getT() == 1000.0 || (cur.getT() < i.getT())) {
-					i = cur;
-				}
-			}
-		}
-
-        return i.getT() != 1000.0;
-    }
-    
     ~LeafNode() {};
 };
 
+// Node of the flattened tree the traversal runs on.  Nodes are laid
+// out depth first, so a split node's left child is the next node and
+// only the right child needs an index.  There are no pointers in it,
+// so a built tree can be written to disk and mapped back as is.
+struct KdNode {
+    glm::dvec3 bmin;
+    glm::dvec3 bmax;
+    double pos;
+    uint32_t axis;      // 0-2 for a split node, KdNode::LEAF for a leaf
+    uint32_t right;     // split node: index of the right child
+    uint32_t first;     // leaf: first entry in the object index list
+    uint32_t count;     // leaf: number of objects
+
+    static const uint32_t LEAF = 3;
+};
+
+// What a saved tree was built from.  A tree file is only used if all
+// of these match the scene being rendered.
+struct KdTreeKey {
+    uint64_t sourceHash;    // hash of the scene text
+    uint32_t sceneVersion;  // version of the parse, which fixes object order
+    uint32_t sceneOptions;  // load options, which can change object bounds
+    uint32_t objectCount;
+    int32_t maxDepth;
+    int32_t leafSize;
+};
+
+namespace kdfile {
+const char MAGIC[8] = { 'S', 'B', 'T', 'K', 'D', 'T', 'R', 'E' };
+// Bump whenever KdNode or the file header changes.
+const uint32_t VERSION = 3;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+}
+
 template<typename T>
 class KdTree
 { 
 public:
-    Node* root = nullptr;
-
     KdTree() {}
 
-    ~KdTree() {
-        delete root;
+    // Build the tree, replacing any earlier one.  The node tree is only
+    // needed until it has been flattened.
+    void buildTree(std::vector<Geometry*> objList, BoundingBox bbox, int depthLimit, int leafSize) {
+        std::unique_ptr<Node> root(buildTreeHelper(objList, bbox, depthLimit, leafSize, 0));
+        flatten(root.get(), objList);
     }
 
-    void buildTree(std::vector<Geometry*> objList, BoundingBox bbox, int depthLimit, int leafSize) {
-        root = buildTreeHelper(objList, bbox, depthLimit, leafSize, 0);
+    // The nearest hit along r before tMax.
+    bool intersect(ray& r, isect& i, double tMax) const {
+        if (nodeCount == 0)
+            return false;
+        return intersectNode(0, r, i, tMax);
     }
 
-    bool intersect(ray& r, isect& i, double& t_min, double& t_max){
-        return root->findIntersection(r, i, t_min, t_max);
+    // Map a tree written by save() back in, if it was saved with the
+    // same key.  objList must be the list the tree was built from.
+    bool load(const std::string& file, const std::vector<T*>& objList, const KdTreeKey& key) {
+        std::unique_ptr<MappedFile> in(new MappedFile(file));
+        if (!in->isOpen() || in->size() < sizeof(FileHeader))
+            return false;
+
+        const FileHeader* h = (const FileHeader*)in->data();
+        if (memcmp(h->magic, kdfile::MAGIC, sizeof(h->magic)) != 0 ||
+            h->version != kdfile::VERSION || h->byteOrder != kdfile::BYTE_ORDER_MARK ||
+            !sameKey(h->key, key))
+            return false;
+        if (h->nodeCount == 0 ||
+            in->size() != sizeof(FileHeader) + h->nodeCount * sizeof(KdNode) + h->itemCount * sizeof(uint32_t))
+            return false;
+
+        const KdNode* n = (const KdNode*)(in->data() + sizeof(FileHeader));
+        const uint32_t* it = (const uint32_t*)(n + h->nodeCount);
+
+        // Everything the traversal follows must stay inside the file.
+        for (uint32_t k = 0; k < h->nodeCount; k++) {
+            if (n[k].axis == KdNode::LEAF) {
+                if (n[k].first > h->itemCount || n[k].count > h->itemCount - n[k].first)
+                    return false;
+            } else if (n[k].axis > 2 || k + 1 >= h->nodeCount ||
+                       n[k].right <= k || n[k].right >= h->nodeCount) {
+                return false;
+            }
+        }
+        for (uint32_t k = 0; k < h->itemCount; k++)
+            if (it[k] >= objList.size())
+                return false;
+
+        objects = objList;
+        builtNodes.clear();
+        builtItems.clear();
+        nodes = n;
+        nodeCount = h->nodeCount;
+        items = it;
+        mapped = std::move(in);
+        groupLeaves();
+        return true;
+    }
+
+    // Write the tree out for load().  Returns false, leaving no file
+    // behind, if it couldn't be written.
+    bool save(const std::string& file, const KdTreeKey& key) const {
+        FileHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, kdfile::MAGIC, sizeof(h.magic));
+        h.version = kdfile::VERSION;
+        h.byteOrder = kdfile::BYTE_ORDER_MARK;
+        h.key.sourceHash = key.sourceHash;
+        h.key.sceneVersion = key.sceneVersion;
+        h.key.sceneOptions = key.sceneOptions;
+        h.key.objectCount = key.objectCount;
+        h.key.maxDepth = key.maxDepth;
+        h.key.leafSize = key.leafSize;
+        h.nodeCount = (uint32_t)nodeCount;
+        h.itemCount = (uint32_t)builtItems.size();
+        if (nodeCount == 0 || nodes != builtNodes.data())
+            return false;
+
+        // written under a temporary name and renamed into place, so a
+        // reader never maps a half-written tree
+        std::string tmp = file + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!f)
+                return false;
+            f.write((const char*)&h, sizeof(h));
+            f.write((const char*)builtNodes.data(), builtNodes.size() * sizeof(KdNode));
+            f.write((const char*)builtItems.data(), builtItems.size() * sizeof(uint32_t));
+            if (!f) {
+                f.close();
+                remove(tmp.c_str());
+                return false;
+            }
+        }
+        if (rename(tmp.c_str(), file.c_str()) != 0) {
+            remove(tmp.c_str());
+            return false;
+        }
+        return true;
     }
 
 private:
 
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        KdTreeKey key;
+        uint32_t nodeCount;
+        uint32_t itemCount;
+    };
+
+    // the objects leaves refer to by index
+    std::vector<T*> objects;
+
+    // The flattened tree, either in builtNodes and builtItems or in a
+    // mapped tree file.
+    const KdNode* nodes = nullptr;
+    size_t nodeCount = 0;
+    const uint32_t* items = nullptr;
+    std::vector<KdNode> builtNodes;
+    std::vector<uint32_t> builtItems;
+    std::unique_ptr<MappedFile> mapped;
+
+    // the objects of each leaf, by kind
+    struct LeafGroup {
+        TriangleBatch triangles;
+        QuadricBatch quadrics;
+        std::vector<T*> others;
+    };
+    std::vector<LeafGroup> leafGroups;
+    std::vector<uint32_t> groupOf;      // node index -> leaf group
+
+    static bool sameKey(const KdTreeKey& a, const KdTreeKey& b) {
+        return a.sourceHash == b.sourceHash && a.sceneVersion == b.sceneVersion &&
+               a.sceneOptions == b.sceneOptions && a.objectCount == b.objectCount && a.maxDepth == b.maxDepth &&
+               a.leafSize == b.leafSize;
+    }
+
+    // Find the nearest hit under node n before tMax, and bring tMax in
+    // to it.  A node whose box the ray only reaches past tMax can't
+    // hold anything nearer, and the child on the side the ray starts
+    // from goes first so that its hits can rule out the other one.
+    bool intersectNode(uint32_t n, ray& r, isect& i, double& tMax) const {
+        const KdNode& node = nodes[n];
+        double tmin, tmax;
+        if (!BoundingBox(node.bmin, node.bmax).intersect(r, tmin, tmax, tMax))
+            return false;
+
+        bool have_one = false;
+        if (node.axis == KdNode::LEAF) {
+            const LeafGroup& leaf = leafGroups[groupOf[n]];
+            if (!leaf.triangles.empty()) {
+                isect cur;
+                if (leaf.triangles.intersect(r, cur, tMax)) {
+                    i = cur;
+                    tMax = cur.getT();
+                    have_one = true;
+                }
+            }
+            if (!leaf.quadrics.empty()) {
+                isect cur;
+                if (leaf.quadrics.intersect(r, cur, tMax)) {
+                    i = cur;
+                    tMax = cur.getT();
+                    have_one = true;
+                }
+            }
+            for (auto obj : leaf.others) {
+                isect cur;
+                if (obj->intersect(r, cur, tMax)) {
+                    i = cur;
+                    tMax = cur.getT();
+                    have_one = true;
+                }
+            }
+            return have_one;
+        }
+
+        uint32_t nearChild = n + 1;
+        uint32_t farChild = node.right;
+        if (r.getDirection()[node.axis] < 0.0)
+            std::swap(nearChild, farChild);
+        if (intersectNode(nearChild, r, i, tMax))
+            have_one = true;
+        if (intersectNode(farChild, r, i, tMax))
+            have_one = true;
+        return have_one;
+    }
+
+    // Lay the tree under root out in builtNodes and builtItems.
+    void flatten(Node* root, const std::vector<T*>& objList) {
+        std::unordered_map<const T*, uint32_t> index;
+        for (size_t k = 0; k < objList.size(); k++)
+            index[objList[k]] = (uint32_t)k;
+
+        objects = objList;
+        mapped.reset();
+        builtNodes.clear();
+        builtItems.clear();
+        flattenNode(root, index);
+        nodes = builtNodes.data();
+        nodeCount = builtNodes.size();
+        items = builtItems.data();
+        groupLeaves();
+    }
+
+    // Sort each leaf's objects by kind: world-space triangles and
+    // quadrics into batches, anything else into a plain list.  A batch
+    // of one isn't worth it, since a batch intersects its nearest
+    // object a second time.  This is rebuilt in memory whenever the
+    // tree is built or loaded.
+    void groupLeaves() {
+        leafGroups.clear();
+        groupOf.assign(nodeCount, 0);
+        for (uint32_t n = 0; n < nodeCount; n++) {
+            if (nodes[n].axis != KdNode::LEAF)
+                continue;
+            groupOf[n] = (uint32_t)leafGroups.size();
+            leafGroups.emplace_back();
+            LeafGroup& g = leafGroups.back();
+            TriangleBatch triangles;
+            QuadricBatch quadrics;
+            for (uint32_t k = nodes[n].first; k < nodes[n].first + nodes[n].count; k++) {
+                T* obj = objects[items[k]];
+                if (!triangles.add(obj) && !quadrics.add(obj))
+                    g.others.push_back(obj);
+            }
+            if (triangles.size() > 1)
+                g.triangles = std::move(triangles);
+            else
+                g.others.insert(g.others.end(), triangles.members().begin(), triangles.members().end());
+            if (quadrics.size() > 1)
+                g.quadrics = std::move(quadrics);
+            else
+                g.others.insert(g.others.end(), quadrics.members().begin(), quadrics.members().end());
+        }
+    }
+
+    void flattenNode(Node* n, const std::unordered_map<const T*, uint32_t>& index) {
+        size_t at = builtNodes.size();
+        builtNodes.push_back(KdNode());
+        KdNode flat;
+        memset(&flat, 0, sizeof(flat));
+
+        if (LeafNode* leaf = dynamic_cast<LeafNode*>(n)) {
+            flat.bmin = leaf->bbox.getMin();
+            flat.bmax = leaf->bbox.getMax();
+            flat.axis = KdNode::LEAF;
+            flat.first = (uint32_t)builtItems.size();
+            flat.count = (uint32_t)leaf->objList.size();
+            for (auto obj : leaf->objList)
+                builtItems.push_back(index.at(obj));
+        } else {
+            SplitNode* split = static_cast<SplitNode*>(n);
+            flat.bmin = split->bbox.getMin();
+            flat.bmax = split->bbox.getMax();
+            flat.pos = split->pos;
+            flat.axis = (uint32_t)split->axis;
+            flattenNode(split->left, index);
+            flat.right = (uint32_t)builtNodes.size();
+            flattenNode(split->right, index);
+        }
+        builtNodes[at] = flat;
+    }
+
     // recursively builds the tree
     Node* buildTreeHelper(std::vector<Geometry*> objList, BoundingBox bbox, int depthLimit, int leafSize, int depth) {
         // base case
         if (objList.size() <= leafSize || ++depth == depthLimit) { 
-            return new LeafNode(objList);
+            return new LeafNode(objList, bbox);
         }
 
         std::vector<Geometry*> leftList;
@@ -170,7 +412,7 @@ private:
 
         // see if split is useless
         if (rightList.empty() || leftList.empty()) {
-            return new LeafNode(objList);
+            return new LeafNode(objList, bbox);
         }
         // o/w return a new split node
         else return new SplitNode(bestPlane.axis, bestPlane.position, bbox,
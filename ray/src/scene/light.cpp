@@ -2,12 +2,40 @@
 #include <iostream>
 
 #include "light.h"
+#include "shadowCache.h"
 #include <glm/glm.hpp>
 #include <glm/gtx/io.hpp>
 
 
 using namespace std;
 
+bool Light::findOccluder(ray& shadow, isect& i, double tMax) const
+{
+	const Scene* scene = getScene();
+	// The debugging view draws shadow rays as Scene::intersect records
+	// them, and a search cut short at the remembered occluder would be
+	// recorded as reaching nothing.
+	if (scene->renderSettings().debug)
+		return scene->intersect(shadow, i, tMax);
+
+	const Geometry* last = ShadowCache::lastOccluder(scene, index);
+	if (last && last->intersect(shadow, i, tMax)) {
+		ShadowCache::count(true);
+		// Something else may still be in front of it.
+		isect nearer;
+		if (scene->intersect(shadow, nearer, i.getT())) {
+			i = nearer;
+			ShadowCache::remember(scene, index, i.getObject());
+		}
+		return true;
+	}
+	ShadowCache::count(false);
+	if (!scene->intersect(shadow, i, tMax))
+		return false;
+	ShadowCache::remember(scene, index, i.getObject());
+	return true;
+}
+
 double DirectionalLight::distanceAttenuation(const glm::dvec3& P) const
 {
 	// distance to light is infinite, so f(di) goes to 0.  Return 1.
@@ -24,7 +52,7 @@ glm::dvec3 DirectionalLight::shadowAttenuation(const ray& r, const glm::dvec3& p
 
 	isect i;
 	ray shadow(p + direction * RAY_EPSILON, direction, glm::dvec3(1, 1, 1), ray::SHADOW);
-	if (this->getScene()->intersect(shadow, i)) {
+	if (findOccluder(shadow, i, std::numeric_limits<double>::infinity())) {
 		return i.getMaterial().kt(i) * color;
 	}
 
@@ -54,6 +82,29 @@ double PointLight::distanceAttenuation(const glm::dvec3& P) const
 	return glm::min(1.0, 1 / (constantTerm + linearTerm * d + quadraticTerm * d * d));
 }
 
+// The light falls under threshold where its brightest channel times
+// f(d) does, which is where a + b d + c d^2 = brightest / threshold.
+bool PointLight::influenceSphere(double threshold, glm::dvec3& center,
+                                 double& radius) const
+{
+	double a = constantTerm, b = linearTerm, c = quadraticTerm;
+	if (threshold <= 0.0 || b < 0.0 || c < 0.0)
+		return false;
+
+	center = position;
+	double brightest = glm::max(color[0], glm::max(color[1], color[2]));
+	double k = brightest / threshold - a;
+	if (brightest < threshold || k <= 0.0)
+		radius = 0.0;
+	else if (c > 0.0)
+		radius = (-b + sqrt(b * b + 4.0 * c * k)) / (2.0 * c);
+	else if (b > 0.0)
+		radius = k / b;
+	else
+		return false;
+	return true;
+}
+
 glm::dvec3 PointLight::getColor() const
 {
 	return color;
@@ -75,12 +126,10 @@ glm::dvec3 PointLight::shadowAttenuation(const ray& r, const glm::dvec3& p) cons
 
 	isect i;
 	ray shadow(p + direction * RAY_EPSILON, direction, glm::dvec3(1, 1, 1), ray::SHADOW);
-	if (this->getScene()->intersect(shadow, i)) {
-		double distToLight = glm::distance(position, p);
-
-		if (i.getT() < distToLight) {
-			return i.getMaterial().kt(i) * color;
-		}
+	// nothing past the light can shadow it
+	double distToLight = glm::distance(position, p);
+	if (findOccluder(shadow, i, distToLight)) {
+		return i.getMaterial().kt(i) * color;
 	}
 
 	return color;
@@ -14,17 +14,34 @@ using std::max;
 class Light
 	: public SceneElement
 {
+	friend class SceneCache;
 public:
 	virtual glm::dvec3 shadowAttenuation(const ray& r, const glm::dvec3& pos) const = 0;
 	virtual double distanceAttenuation(const glm::dvec3& P) const = 0;
 	virtual glm::dvec3 getColor() const = 0;
 	virtual glm::dvec3 getDirection (const glm::dvec3& P) const = 0;
 
+	// Where the light can add threshold or more to a surface, as a
+	// sphere; a radius of 0 means nowhere.  Returns false if the light
+	// reaches everywhere, which is the default.
+	virtual bool influenceSphere(double /*threshold*/,
+	                             glm::dvec3& /*center*/,
+	                             double& /*radius*/) const { return false; }
+
+	// The light's place in the scene's list, set by Scene::add.
+	int getIndex() const { return index; }
+	void setIndex(int n) { index = n; }
 
 protected:
 	Light(Scene *scene, const glm::dvec3& col) : SceneElement(scene), color(col) {}
 
+	// The nearest hit along the shadow ray before tMax, trying the
+	// object that last blocked this light on this thread first (see
+	// ShadowCache).  Finds the same hit Scene::intersect would.
+	bool findOccluder(ray& shadow, isect& i, double tMax) const;
+
 	glm::dvec3 color;
+	int index = -1;
 
 public:
 	virtual void glDraw(GLenum lightID) const { }
@@ -34,6 +51,7 @@ public:
 class DirectionalLight
 	: public Light
 {
+	friend class SceneCache;
 public:
 	DirectionalLight(Scene *scene, const glm::dvec3& orien, const glm::dvec3& color)
 		: Light(scene, color), orientation(glm::normalize(orien)) { }
@@ -53,6 +71,7 @@ public:
 class PointLight
 	: public Light
 {
+	friend class SceneCache;
 public:
 	PointLight( Scene *scene, const glm::dvec3& pos, const glm::dvec3& color,
 		float constantAttenuationTerm, float linearAttenuationTerm,
@@ -67,6 +86,8 @@ public:
 	virtual double distanceAttenuation(const glm::dvec3& P) const;
 	virtual glm::dvec3 getColor() const;
 	virtual glm::dvec3 getDirection(const glm::dvec3& P) const;
+	virtual bool influenceSphere(double threshold, glm::dvec3& center,
+	                             double& radius) const;
 
 	void setAttenuationConstants(float a, float b, float c)
 	{
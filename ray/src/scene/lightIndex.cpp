@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cmath>
+
+#include "lightIndex.h"
+#include "light.h"
+
+using namespace std;
+
+// at most this many cells along each axis
+static const int MAX_CELLS = 32;
+
+void LightIndex::build(const std::vector<const Light*>& lights, double threshold)
+{
+	built = true;
+	lightCount = lights.size();
+	builtThreshold = threshold;
+	grid.clear();
+	everywhere.clear();
+	cells[0] = cells[1] = cells[2] = 0;
+
+	// Where each light reaches: radius > 0 within a sphere, radius 0
+	// nowhere that matters, radius < 0 everywhere.
+	struct Reach {
+		const Light* light;
+		glm::dvec3 center;
+		double radius;
+	};
+	std::vector<Reach> reach;
+	glm::dvec3 lo(0.0), hi(0.0);
+	size_t bounded = 0;
+	for (const Light* l : lights) {
+		Reach r;
+		r.light = l;
+		if (!l->influenceSphere(threshold, r.center, r.radius)) {
+			r.radius = -1.0;
+			everywhere.push_back(l);
+		} else if (r.radius > 0.0) {
+			glm::dvec3 extent(r.radius);
+			lo = bounded ? glm::min(lo, r.center - extent) : r.center - extent;
+			hi = bounded ? glm::max(hi, r.center + extent) : r.center + extent;
+			bounded++;
+		}
+		reach.push_back(r);
+	}
+	if (!bounded)
+		return;
+
+	// about two cells per light along each axis
+	int n = (int)std::ceil(2.0 * std::cbrt((double)bounded));
+	n = std::max(1, std::min(n, MAX_CELLS));
+	gridMin = lo;
+	for (int a = 0; a < 3; a++) {
+		cells[a] = n;
+		cellSize[a] = std::max((hi[a] - lo[a]) / n, 1e-9);
+	}
+	grid.resize(cells[0] * cells[1] * cells[2]);
+
+	// in scene order, so every cell lists its lights in it
+	for (const Reach& r : reach) {
+		if (r.radius < 0.0) {
+			for (auto& cell : grid)
+				cell.push_back(r.light);
+		} else if (r.radius > 0.0) {
+			int c0[3], c1[3];
+			for (int a = 0; a < 3; a++) {
+				c0[a] = std::max(0, (int)((r.center[a] - r.radius - gridMin[a]) / cellSize[a]));
+				c1[a] = std::min(cells[a] - 1, (int)((r.center[a] + r.radius - gridMin[a]) / cellSize[a]));
+			}
+			for (int z = c0[2]; z <= c1[2]; z++)
+				for (int y = c0[1]; y <= c1[1]; y++)
+					for (int x = c0[0]; x <= c1[0]; x++)
+						grid[cellIndex(x, y, z)].push_back(r.light);
+		}
+	}
+}
+
+const std::vector<const Light*>& LightIndex::lightsAt(const glm::dvec3& p) const
+{
+	if (grid.empty())
+		return everywhere;
+	int c[3];
+	for (int a = 0; a < 3; a++) {
+		double f = (p[a] - gridMin[a]) / cellSize[a];
+		if (!(f >= 0.0) || f >= cells[a])
+			return everywhere;
+		c[a] = std::min((int)f, cells[a] - 1);
+	}
+	return grid[cellIndex(c[0], c[1], c[2])];
+}
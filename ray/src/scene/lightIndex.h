@@ -0,0 +1,52 @@
+#ifndef __LIGHTINDEX_H__
+#define __LIGHTINDEX_H__
+
+#include <vector>
+#include <glm/vec3.hpp>
+
+class Light;
+
+/*
+   LightIndex finds the lights that can light a point.  Past its
+   influence radius (Light::influenceSphere) a light adds less than the
+   render threshold, so lights with a finite radius are binned into a
+   uniform grid by the box around their sphere of influence.  Lights
+   without one, such as directional lights, are in every cell.  A cell
+   lists its lights in scene order, so shading adds them up in the same
+   order it would going through all of them.
+*/
+class LightIndex {
+public:
+	// Index lights for the given threshold, dropping the ones that
+	// never reach it anywhere.
+	void build(const std::vector<const Light*>& lights, double threshold);
+
+	// True if build() was last called with this many lights and this
+	// threshold.
+	bool builtFor(size_t count, double threshold) const
+	{
+		return built && count == lightCount && threshold == builtThreshold;
+	}
+
+	// The lights that may reach p by more than the threshold.  Some of
+	// them may not, if p is near the edge of their range.
+	const std::vector<const Light*>& lightsAt(const glm::dvec3& p) const;
+
+private:
+	bool built = false;
+	size_t lightCount = 0;
+	double builtThreshold = 0.0;
+
+	glm::dvec3 gridMin;
+	glm::dvec3 cellSize;
+	int cells[3] = { 0, 0, 0 };
+	std::vector<std::vector<const Light*>> grid;
+	std::vector<const Light*> everywhere;	// lights with no radius
+
+	int cellIndex(int x, int y, int z) const
+	{
+		return (z * cells[1] + y) * cells[0] + x;
+	}
+};
+
+#endif // __LIGHTINDEX_H__
@@ -6,6 +6,10 @@ extern TraceUI* traceUI;
 
 #include <glm/gtx/io.hpp>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <string.h>
 #include "../fileio/images.h"
 
 using namespace std;
@@ -15,6 +19,51 @@ Material::~Material()
 {
 }
 
+// floor on the cosine term of the light sampling guess
+static const double LIGHT_SAMPLE_MIN_COSINE = 0.05;
+
+// Random numbers seeded from a shading point and the direction it is
+// seen from, so that sampling lights needs no state shared between
+// threads and a render comes out the same every time.  Each sample
+// of a supersampled pixel lands on a different point, so it gets
+// different numbers.
+class PointRandom {
+public:
+	PointRandom(const glm::dvec3& p, const glm::dvec3& d) : state(0)
+	{
+		for (int a = 0; a < 3; a++) {
+			mix(p[a]);
+			mix(d[a]);
+		}
+	}
+
+	// uniform in [0, 1)
+	double next()
+	{
+		return (double)(step() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+private:
+	uint64_t state;
+
+	// splitmix64
+	uint64_t step()
+	{
+		uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+
+	void mix(double x)
+	{
+		uint64_t bits;
+		memcpy(&bits, &x, sizeof(bits));
+		state ^= bits;
+		step();
+	}
+};
+
 // Apply the phong model to this point on the surface of the object, returning
 // the color of that point.
 glm::dvec3 Material::shade(Scene* scene, const ray& r, const isect& i) const
@@ -52,92 +101,226 @@ glm::dvec3 Material::shade(Scene* scene, const ray& r, const isect& i) const
 
 	glm::dvec3 pos = r.at(i);
 	glm::dvec3 n = i.getN();
+	glm::dvec3 v = glm::normalize(scene->getCamera().getEye() - pos);
+	bool shadows = scene->renderSettings().shadows;
 
-	// loop through all lights
-	for (const auto& pLight : scene->getAllLights()) {
+	// what one light adds at this point
+	auto contribution = [&](const Light* pLight) {
 		glm::dvec3 l = pLight->getDirection(pos);
 
-		// atten = dist atten * shadow atten
-		glm::dvec3 atten = pLight->distanceAttenuation(pos) * pLight->shadowAttenuation(r, pos);
+		// atten = dist atten * shadow atten, which carries the light's
+		// color
+		glm::dvec3 atten(pLight->distanceAttenuation(pos));
+		if (shadows)
+			atten *= pLight->shadowAttenuation(r, pos);
+		else
+			atten *= pLight->getColor();
 
 		// calculate diffuse term
 		glm::dvec3 diffuse = kd(i) * glm::max(glm::dot(l, n), 0.0);
 
 		// calculate specular term
-		glm::dvec3 v = glm::normalize(scene->getCamera().getEye() - pos);
-		// glm::dvec3 v = - r.getDirection();
 		glm::dvec3 r = (2 * glm::dot(l, n) * n) - l;
 		glm::dvec3 specular = ks(i) * glm::pow(glm::max(glm::dot(r, v), 0.0), shininess(i));
 
-		colorC += atten * (diffuse + specular);
+		return atten * (diffuse + specular);
+	};
+
+	// loop through the lights that can reach this point
+	const std::vector<const Light*>& lights = scene->lightsAt(pos);
+	int samples = scene->renderSettings().lightSamples;
+	if (samples <= 0 || (size_t)samples >= lights.size()) {
+		for (const Light* pLight : lights)
+			colorC += contribution(pLight);
+		return colorC;
+	}
+
+	// Too many lights: pick samples of them, each with a chance in
+	// proportion to a guess at what it adds, and scale what it adds
+	// by one over that chance, so that on average this comes to the
+	// full sum.  The guess is the light's brightest channel times its
+	// distance attenuation and the cosine at the surface; the cosine
+	// has a floor because lights behind the surface can still add
+	// specular.
+	static thread_local std::vector<double> cdf;
+	cdf.resize(lights.size());
+	double total = 0.0;
+	for (size_t k = 0; k < lights.size(); k++) {
+		glm::dvec3 c = lights[k]->getColor();
+		double cosine = glm::dot(lights[k]->getDirection(pos), n);
+		total += glm::max(c[0], glm::max(c[1], c[2])) *
+		         lights[k]->distanceAttenuation(pos) *
+		         glm::max(cosine, LIGHT_SAMPLE_MIN_COSINE);
+		cdf[k] = total;
+	}
+	if (!(total > 0.0))
+		return colorC;
+
+	PointRandom random(pos, r.getDirection());
+	for (int s = 0; s < samples; s++) {
+		double u = random.next() * total;
+		size_t k = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+		k = std::min(k, lights.size() - 1);
+		double chance = (cdf[k] - (k > 0 ? cdf[k - 1] : 0.0)) / total;
+		colorC += contribution(lights[k]) / (samples * chance);
 	}
 
 	return colorC;
 }
 
 TextureMap::TextureMap(string filename)
+	: filename(filename), width(0), height(0)
+{
+}
+
+void TextureMap::load()
+{
+	// A failed decode is kept and reported again by every load(),
+	// rather than rendering with an empty texture.  It is not thrown
+	// out of call_once, which some pthread-based implementations
+	// don't survive.
+	std::call_once(loaded, [this]() {
+		int w = 0, h = 0;
+		std::vector<uint8_t> data = readImage(filename.c_str(), w, h);
+		if (data.empty()) {
+			loadError = "Unable to load texture map '";
+			loadError.append(filename);
+			loadError.append("'.");
+			return;
+		}
+		width = w;
+		height = h;
+		buildMipmaps(data);
+		ready.store(true, std::memory_order_release);
+	});
+	if (!loadError.empty())
+		throw TextureMapException(loadError);
+}
+
+TextureMap::MipLevel::MipLevel(int w, int h)
+	: width(w), height(h)
+{
+	// pad to whole tiles so offset() never needs a bounds check
+	tilesX = (w + TILE_MASK) >> TILE_SHIFT;
+	int tilesY = (h + TILE_MASK) >> TILE_SHIFT;
+	texels.resize(3 * (tilesX * tilesY) << (2 * TILE_SHIFT));
+}
+
+TextureMap::MipLevel TextureMap::MipLevel::downsample() const
 {
-	data = readImage(filename.c_str(), width, height);
-	if (data.empty()) {
-		width = 0;
-		height = 0;
-		string error("Unable to load texture map '");
-		error.append(filename);
-		error.append("'.");
-		throw TextureMapException(error);
+	MipLevel dst(std::max(1, width / 2), std::max(1, height / 2));
+	for (int y = 0; y < dst.height; ++y) {
+		int y0 = std::min(2 * y, height - 1);
+		int y1 = std::min(2 * y + 1, height - 1);
+		for (int x = 0; x < dst.width; ++x) {
+			int x0 = std::min(2 * x, width - 1);
+			int x1 = std::min(2 * x + 1, width - 1);
+			const float* t00 = at(x0, y0);
+			const float* t10 = at(x1, y0);
+			const float* t01 = at(x0, y1);
+			const float* t11 = at(x1, y1);
+			float* out = dst.at(x, y);
+			for (int c = 0; c < 3; ++c)
+				out[c] = 0.25f * (t00[c] + t10[c] + t01[c] + t11[c]);
+		}
 	}
+	return dst;
 }
 
-glm::dvec3 TextureMap::getMappedValue(const glm::dvec2& coord) const
+// Convert the bitmap to floats once, then box filter it down to a
+// single texel so that lookups can pick a level matching the ray
+// footprint instead of aliasing on the full resolution image.
+void TextureMap::buildMipmaps(const std::vector<uint8_t>& data)
 {
-	// YOUR CODE HERE
-	//
-	// In order to add texture mapping support to the
-	// raytracer, you need to implement this function.
-	// What this function should do is convert from
-	// parametric space which is the unit square
-	// [0, 1] x [0, 1] in 2-space to bitmap coordinates,
-	// and use these to perform bilinear interpolation
-	// of the values.
-
-	double w = (double) getWidth();
-	double h = (double) getHeight();
-
-	int x = (int) round(coord.x * w);
-	int y = (int) round(coord.y * h);
-
-	if (x >= w) {
-		x = w - 1;
+	levels.clear();
+	levels.emplace_back(width, height);
+	MipLevel& base = levels.back();
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			const uint8_t* src = &data[3 * (y * width + x)];
+			float* dst = base.at(x, y);
+			dst[0] = src[0] / 255.0f;
+			dst[1] = src[1] / 255.0f;
+			dst[2] = src[2] / 255.0f;
+		}
 	}
-	if (y >= h) {
-		y = h - 1;
+
+	while (levels.back().width > 1 || levels.back().height > 1)
+		levels.push_back(levels.back().downsample());
+}
+
+glm::dvec3 TextureMap::bilinear(const MipLevel& level, const glm::dvec2& coord) const
+{
+	// texel centers sit at half-integer coordinates
+	double x = glm::clamp(coord.x, 0.0, 1.0) * level.width - 0.5;
+	double y = glm::clamp(coord.y, 0.0, 1.0) * level.height - 0.5;
+	double fx = floor(x);
+	double fy = floor(y);
+	double wx = x - fx;
+	double wy = y - fy;
+
+	int x0 = std::max((int)fx, 0);
+	int y0 = std::max((int)fy, 0);
+	int x1 = std::min((int)fx + 1, level.width - 1);
+	int y1 = std::min((int)fy + 1, level.height - 1);
+
+	const float* t00 = level.at(x0, y0);
+	const float* t10 = level.at(x1, y0);
+	const float* t01 = level.at(x0, y1);
+	const float* t11 = level.at(x1, y1);
+
+	glm::dvec3 ret;
+	for (int c = 0; c < 3; ++c) {
+		double top = t00[c] + wx * (t10[c] - t00[c]);
+		double bottom = t01[c] + wx * (t11[c] - t01[c]);
+		ret[c] = top + wy * (bottom - top);
 	}
+	return ret;
+}
 
-	return getPixelAt(x, y);
+glm::dvec3 TextureMap::getMappedValue(const glm::dvec2& coord) const
+{
+	return bilinear(levels[0], coord);
+}
+
+glm::dvec3 TextureMap::getMappedValue(const glm::dvec2& coord, double footprint) const
+{
+	// level of detail: log2 of the footprint measured in base texels
+	double texels = footprint * std::max(width, height);
+	if (texels <= 1.0)
+		return bilinear(levels[0], coord);
+
+	double lod = std::min(log2(texels), double(levels.size() - 1));
+	int lo = (int)lod;
+	int hi = std::min(lo + 1, (int)levels.size() - 1);
+	double w = lod - lo;
+
+	glm::dvec3 a = bilinear(levels[lo], coord);
+	if (hi == lo || w == 0.0)
+		return a;
+	return a + w * (bilinear(levels[hi], coord) - a);
 }
 
 glm::dvec3 TextureMap::getPixelAt(int x, int y) const
 {
-	// YOUR CODE HERE
-	//
-	// In order to add texture mapping support to the
-	// raytracer, you need to implement this function.
+	return getPixelAt(x, y, 0);
+}
 
-	// if (0 == data){
-	// 	return glm::dvec3(1, 1, 1);
-	// }
+glm::dvec3 TextureMap::getPixelAt(int x, int y, int level) const
+{
+	const MipLevel& l = levels[level];
+	x = glm::clamp(x, 0, l.width - 1);
+	y = glm::clamp(y, 0, l.height - 1);
 
-	int index = 3 * (y * getWidth() + x);
-	return glm::dvec3(
-		data[index] / 255.0,
-		data[index + 1] / 255.0,
-		data[index + 2] / 255.0);
+	const float* texel = l.at(x, y);
+	return glm::dvec3(texel[0], texel[1], texel[2]);
 }
 
 glm::dvec3 MaterialParameter::value(const isect& is) const
 {
 	if (0 != _textureMap)
-		return _textureMap->getMappedValue(is.getUVCoordinates());
+		return _textureMap->getMappedValue(is.getUVCoordinates(),
+		                                   is.getUVFootprint());
 	else
 		return _value;
 }
@@ -146,7 +329,8 @@ double MaterialParameter::intensityValue(const isect& is) const
 {
 	if (0 != _textureMap) {
 		glm::dvec3 value(
-		        _textureMap->getMappedValue(is.getUVCoordinates()));
+		        _textureMap->getMappedValue(is.getUVCoordinates(),
+		                                    is.getUVFootprint()));
 		return (0.299 * value[0]) + (0.587 * value[1]) +
 		       (0.114 * value[2]);
 	} else
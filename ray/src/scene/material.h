@@ -10,6 +10,8 @@
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <glm/glm.hpp>
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -22,34 +24,96 @@ using std::string;
 
 /* The TextureMap class can be used to store a texture map,
    which consists of a bitmap and various accessors to
-   it.  To implement basic texture mapping, you'll want to 
-   fill in the getMappedValue function to implement basic 
-   texture mapping.
+   it.  The bitmap is converted to floating point when it
+   is loaded and a mip pyramid is built from it, so lookups
+   never touch the raw bytes and can be filtered to the
+   footprint of the ray that hits the surface.
+
+   Texture maps are normally obtained from the TextureCache, which
+   shares them between scenes.  Constructing one only records the
+   file name; the image is decoded on the first call to load().
 */
 class TextureMap {
     public:
+       // One level of the mip pyramid, RGB triples in [0, 1].
+       // Texels are stored in 4x4 tiles so that the neighbours a
+       // filtered lookup touches share cache lines; use at() rather
+       // than indexing texels directly.
+       class MipLevel {
+       public:
+           MipLevel( int w, int h );
+
+           const float* at( int x, int y ) const { return &texels[offset( x, y )]; }
+           float* at( int x, int y ) { return &texels[offset( x, y )]; }
+
+           // 2x2 box filtered copy at half the resolution
+           MipLevel downsample() const;
+
+           int width;
+           int height;
+
+       private:
+           static const int TILE_SHIFT = 2;
+           static const int TILE_MASK = ( 1 << TILE_SHIFT ) - 1;
+
+           size_t offset( int x, int y ) const
+           {
+               size_t tile = ( y >> TILE_SHIFT ) * tilesX + ( x >> TILE_SHIFT );
+               size_t texel = ( ( y & TILE_MASK ) << TILE_SHIFT ) | ( x & TILE_MASK );
+               return 3 * ( ( tile << ( 2 * TILE_SHIFT ) ) + texel );
+           }
+
+           int tilesX;
+           std::vector<float> texels;
+       };
+
        TextureMap( string filename );
 
+       // Decode the image and build the mip pyramid, if that has
+       // not happened yet.  Safe to call from several threads.
+       // Throws TextureMapException if the image cannot be read.
+       void load();
+       // True once load() has finished; the levels are then complete
+       // and safe to read from any thread.
+       bool isLoaded() const { return ready.load(std::memory_order_acquire); }
+       const string& getFilename() const { return filename; }
+
        // Return the mapped value; here the coordinate
        // is assumed to be within the parametrization space:
        // [0, 1] x [0, 1]
        // (i.e., {(u, v): 0 <= u <= 1 and 0 <= v <= 1}
+       // This does a bilinear lookup in the full resolution level.
        glm::dvec3 getMappedValue( const glm::dvec2& coord ) const;
 
+       // Same as above, but footprint is the width of the sample
+       // in parametrization space.  The two closest mip levels are
+       // chosen from it and blended (trilinear filtering).
+       glm::dvec3 getMappedValue( const glm::dvec2& coord, double footprint ) const;
+
        // Retrieve the value stored in a physical location
-       // (with integer coordinates) in the bitmap.
-       // Should be called from getMappedValue in order to
-       // do bilinear interpolation.
+       // (with integer coordinates) in the bitmap, or in one
+       // of its mip levels.
        glm::dvec3 getPixelAt( int x, int y ) const;
+       glm::dvec3 getPixelAt( int x, int y, int level ) const;
 
 	   int getWidth() const { return width; }
 	   int getHeight() const { return height; }
+	   int getLevels() const { return (int)levels.size(); }
+	   const MipLevel& getLevel( int level ) const { return levels[level]; }
 
 	  ~TextureMap() { }
 protected:
+       void buildMipmaps( const std::vector<uint8_t>& data );
+       glm::dvec3 bilinear( const MipLevel& level, const glm::dvec2& coord ) const;
+
+       string filename;
+       std::once_flag loaded;
+       std::atomic<bool> ready{ false };	// set as load() returns
+       string loadError;	// why the decode failed, if it did
+
        int width;
        int height;
-       std::vector<uint8_t> data;
+       std::vector<MipLevel> levels;
 };
 
 class TextureMapException {
@@ -77,6 +141,7 @@ Material class is used often enough, that it is
 
 class MaterialParameter
 {
+    friend class SceneCache;
 public:
     explicit MaterialParameter( const glm::dvec3& par )
       : _value( par ), _textureMap( 0 )
@@ -158,6 +223,7 @@ private:
 
 class Material
 {
+    friend class SceneCache;
 
 public:
     Material()
@@ -13,12 +13,14 @@ ray::ray(const glm::dvec3& pp,
 	 const glm::dvec3& dd,
 	 const glm::dvec3& w,
          RayType tt)
-        : p(pp), d(dd), atten(w), t(tt)
+        : p(pp), d(dd), atten(w), t(tt), coneWidth(0.0), coneSpread(0.0)
 {
 	TraceUI::addRay(ray_thread_id);
 }
 
-ray::ray(const ray& other) : p(other.p), d(other.d), atten(other.atten)
+ray::ray(const ray& other)
+        : p(other.p), d(other.d), atten(other.atten), t(other.t),
+          coneWidth(other.coneWidth), coneSpread(other.coneSpread)
 {
 	TraceUI::addRay(ray_thread_id);
 }
@@ -33,6 +35,8 @@ ray& ray::operator=(const ray& other)
 	d     = other.d;
 	atten = other.atten;
 	t     = other.t;
+	coneWidth  = other.coneWidth;
+	coneSpread = other.coneSpread;
 	return *this;
 }
 
@@ -48,11 +48,25 @@ public:
 	void setPosition(const glm::dvec3& pp) { p = pp; }
 	void setDirection(const glm::dvec3& dd) { d = dd; }
 
+	// Ray cone used as a cheap ray differential: the width of the
+	// ray's footprint at its origin, and how fast that width grows
+	// per unit of distance travelled.  Used to pick texture LODs.
+	double getConeWidth() const { return coneWidth; }
+	double getConeSpread() const { return coneSpread; }
+	double footprintAt(double tt) const { return coneWidth + coneSpread * tt; }
+	void setCone(double width, double spread)
+	{
+		coneWidth  = width;
+		coneSpread = spread;
+	}
+
 private:
 	glm::dvec3 p;
 	glm::dvec3 d;
 	glm::dvec3 atten;
 	RayType t;
+	double coneWidth;
+	double coneSpread;
 };
 
 
@@ -60,7 +74,7 @@ private:
 
 class isect {
 public:
-	isect() : obj(NULL), t(0.0), N(), material(nullptr) {}
+	isect() : obj(NULL), t(0.0), N(), uvFootprint(0.0), material(nullptr) {}
 	isect(const isect& other)
 	{
 		copyFromOther(other);
@@ -75,6 +89,7 @@ public:
 	}
 
 	void setObject(const SceneObject* o) { obj = o; }
+	const SceneObject* getObject() const { return obj; }
 
 	// Get/Set Time of flight
 	void setT(double tt) { t = tt; }
@@ -95,6 +110,9 @@ public:
 		uvCoordinates = coords;
 	}
 	glm::dvec2 getUVCoordinates() const { return uvCoordinates; }
+	// Width of the ray footprint in uv space, 0 if unknown.
+	void setUVFootprint(double w) { uvFootprint = w; }
+	double getUVFootprint() const { return uvFootprint; }
 	void setBary(const glm::dvec3& weights) { bary = weights; }
 	void setBary(const double alpha, const double beta, const double gamma)
 	{
@@ -112,6 +130,7 @@ private:
 		N             = other.N;
 		bary          = other.bary;
 		uvCoordinates = other.uvCoordinates;
+		uvFootprint   = other.uvFootprint;
 		if (other.material) {
 			setMaterial(*other.material);
 		} else {
@@ -123,6 +142,7 @@ private:
 	double t;
 	glm::dvec3 N;
 	glm::dvec2 uvCoordinates;
+	double uvFootprint;
 	glm::dvec3 bary;
 
 	// if this intersection has its own material
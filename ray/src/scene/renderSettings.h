@@ -0,0 +1,39 @@
+#ifndef __RENDERSETTINGS_H__
+#define __RENDERSETTINGS_H__
+
+class CubeMap;
+
+/*
+   The switches and limits a render runs with.  RayTracer::traceSetup
+   copies them out of the TraceUI once and hands the scene its own
+   copy, so nothing on the path of a ray asks the UI for them, and a
+   control changed halfway through a render can't change how the rest
+   of the image is traced.
+
+   The kd-tree and debugging switches pick which instantiation of the
+   render loop runs (RayTracer::traceRay, Scene::intersect); the others
+   are read from the copy where they are needed.
+*/
+struct RenderSettings {
+	int depth = 0;           // max depth of recursion
+	double threshold = 0.0;  // ray weight below which tracing stops
+	bool kdTree = true;      // intersect through the kd-tree?
+	bool smoothShade = true; // interpolate trimesh vertex normals?
+	bool shadows = true;     // cast shadow rays?
+	bool debug = false;      // record rays for the debugging view?
+	const CubeMap* cubeMap = nullptr; // what rays that miss see, if set
+	bool wavefront = false;  // trace tiles a generation of rays at a time?
+	int lightSamples = 0;    // lights sampled per shading point, 0 for all
+
+	bool operator==(const RenderSettings& o) const
+	{
+		return depth == o.depth && threshold == o.threshold &&
+		       kdTree == o.kdTree && smoothShade == o.smoothShade &&
+		       shadows == o.shadows && debug == o.debug &&
+		       cubeMap == o.cubeMap && wavefront == o.wavefront &&
+		       lightSamples == o.lightSamples;
+	}
+	bool operator!=(const RenderSettings& o) const { return !(*this == o); }
+};
+
+#endif // __RENDERSETTINGS_H__
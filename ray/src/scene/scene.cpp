@@ -1,19 +1,87 @@
+#include <atomic>
 #include <cmath>
 
 #include "scene.h"
 #include "light.h"
 #include "kdTree.h"
-#include "../ui/TraceUI.h"
+#include "textureCache.h"
+#include "sceneCache.h"
 #include <glm/gtx/extended_min_max.hpp>
 #include <iostream>
 #include <glm/gtx/io.hpp>
 
 using namespace std;
-extern TraceUI* traceUI;
 
-bool Geometry::intersect(ray& r, isect& i) const {
+void TransformNode::classify()
+{
+	const glm::dmat4x4& m = xform;
+	xformOffset = glm::dvec3(m[3][0], m[3][1], m[3][2]);
+	xformScale = m[0][0];
+
+	bool affine = m[0][3] == 0.0 && m[1][3] == 0.0 && m[2][3] == 0.0 &&
+	              m[3][3] == 1.0;
+	bool scaled = m[1][1] == xformScale && m[2][2] == xformScale &&
+	              m[0][1] == 0.0 && m[0][2] == 0.0 &&
+	              m[1][0] == 0.0 && m[1][2] == 0.0 &&
+	              m[2][0] == 0.0 && m[2][1] == 0.0;
+
+	if (!affine || !scaled || !(xformScale > 0.0))
+		xformKind = GENERAL;
+	else if (xformScale != 1.0)
+		xformKind = UNIFORM_SCALE;
+	else if (xformOffset != glm::dvec3(0.0))
+		xformKind = TRANSLATE;
+	else
+		xformKind = IDENTITY;
+}
+
+bool Geometry::intersect(ray& r, isect& i, double tMax) const {
 	double tmin, tmax;
-	if (hasBoundingBoxCapability() && !(bounds.intersect(r, tmin, tmax))) return false;
+	if (hasBoundingBoxCapability() && !(bounds.intersect(r, tmin, tmax, tMax))) return false;
+	return intersectGlobal(r, i) && i.getT() < tMax;
+}
+
+bool Geometry::intersectGlobal(ray& r, isect& i) const {
+	// Rays are unit length, so for these the local ray's direction is
+	// the world one and only the origin (and, when scaled, t and the
+	// cone width) need converting.
+	switch (transform->kind()) {
+	case TransformNode::IDENTITY:
+		if (!intersectLocal(r, i))
+			return false;
+		i.setN(glm::normalize(i.getN()));
+		return true;
+
+	case TransformNode::TRANSLATE: {
+		glm::dvec3 Wpos = r.getPosition();
+		r.setPosition(Wpos - transform->offset());
+		bool hit = intersectLocal(r, i);
+		r.setPosition(Wpos);
+		if (hit)
+			i.setN(glm::normalize(i.getN()));
+		return hit;
+	}
+
+	case TransformNode::UNIFORM_SCALE: {
+		double s = transform->scale();
+		glm::dvec3 Wpos = r.getPosition();
+		double Wwidth = r.getConeWidth();
+		r.setPosition((Wpos - transform->offset()) / s);
+		r.setCone(Wwidth / s, r.getConeSpread());
+		bool hit = intersectLocal(r, i);
+		r.setPosition(Wpos);
+		r.setCone(Wwidth, r.getConeSpread());
+		if (hit) {
+			i.setN(glm::normalize(i.getN()));
+			i.setT(i.getT() * s);
+		}
+		return hit;
+	}
+
+	case TransformNode::GENERAL:
+		break;
+	}
+
 	// Transform the ray into the object's local coordinate space
 	glm::dvec3 pos = transform->globalToLocalCoords(r.getPosition());
 	glm::dvec3 dir = transform->globalToLocalCoords(r.getPosition() + r.getDirection()) - pos;
@@ -22,8 +90,11 @@ bool Geometry::intersect(ray& r, isect& i) const {
 	// Backup World pos/dir, and switch to local pos/dir
 	glm::dvec3 Wpos = r.getPosition();
 	glm::dvec3 Wdir = r.getDirection();
+	double Wwidth = r.getConeWidth();
 	r.setPosition(pos);
 	r.setDirection(dir);
+	// the cone spread is per unit distance, so only its width rescales
+	r.setCone(Wwidth * length, r.getConeSpread());
 	bool rtrn = false;
 	if (intersectLocal(r, i))
 	{
@@ -35,6 +106,7 @@ bool Geometry::intersect(ray& r, isect& i) const {
 	// Restore World pos/dir
 	r.setPosition(Wpos);
 	r.setDirection(Wdir);
+	r.setCone(Wwidth, r.getConeSpread());
 	return rtrn;
 }
 
@@ -105,65 +177,121 @@ void Scene::add(Geometry* obj) {
 	obj->ComputeBoundingBox();
 	sceneBounds.merge(obj->getBoundingBox());
 	objects.emplace_back(obj);
+	generation++;
 }
 
 void Scene::add(Light* light)
 {
+	light->setIndex(lights.size());
 	lights.emplace_back(light);
 }
 
 
-// Get any intersection with an object.  Return information about the 
-// intersection through the reference parameter.
-bool Scene::intersect(ray& r, isect& i) const {
-	double tmin = 0.0;
-	double tmax = 0.0;
+// Epochs are unique across scenes, so a thread's ShadowCache can't
+// mistake a new scene for the one it last saw.
+static std::atomic<uint64_t> nextRenderEpoch(1);
+
+void Scene::setRenderSettings(const RenderSettings& s)
+{
+	settings = s;
+	epoch = nextRenderEpoch++;
+	if (!lightIndex.builtFor(lights.size(), settings.threshold)) {
+		std::vector<const Light*> all;
+		for (const auto& l : lights)
+			all.push_back(l.get());
+		lightIndex.build(all, settings.threshold);
+	}
+}
+
+// Get the nearest intersection with an object before tMax.  Return
+// information about the intersection through the reference parameter.
+bool Scene::intersect(ray& r, isect& i, double tMax) const {
+	if (settings.kdTree)
+		return settings.debug ? intersect<true, true>(r, i, tMax)
+		                      : intersect<true, false>(r, i, tMax);
+	return settings.debug ? intersect<false, true>(r, i, tMax)
+	                      : intersect<false, false>(r, i, tMax);
+}
+
+template<bool UseTree, bool Debug>
+bool Scene::intersect(ray& r, isect& i, double tMax) const {
 	bool have_one = false;
 
 	// check if using kd trees
-	if (traceUI->kdSwitch()) {
-		i.setT(1000.0);
-		have_one = kdtree->intersect(r, i, tmin, tmax);
+	if (UseTree) {
+		have_one = kdtree->intersect(r, i, tMax);
 	} else {
+		// each hit found brings in the distance the rest must beat
 		for(const auto& obj : objects) {
 			isect cur;
-			if( obj->intersect(r, cur) ) {
-				if(!have_one || (cur.getT() < i.getT())) {
-					i = cur;
-					have_one = true;
-				}
+			if( obj->intersect(r, cur, have_one ? i.getT() : tMax) ) {
+				i = cur;
+				have_one = true;
 			}
 		}
 	}
 
 
 	if(!have_one)
-		i.setT(1000.0);
+		i.setT(std::numeric_limits<double>::infinity());
 	// if debugging,
-	if (TraceUI::m_debug)
+	if (Debug)
 	{
 		addToIntersectCache(std::make_pair(new ray(r), new isect(i)));
 	}
 	return have_one;
 }
 
+template bool Scene::intersect<false, false>(ray&, isect&, double) const;
+template bool Scene::intersect<false, true>(ray&, isect&, double) const;
+template bool Scene::intersect<true, false>(ray&, isect&, double) const;
+template bool Scene::intersect<true, true>(ray&, isect&, double) const;
+
 TextureMap* Scene::getTexture(string name) {
 	auto itr = textureCache.find(name);
 	if (itr == textureCache.end()) {
-		textureCache[name].reset(new TextureMap(name));
-		return textureCache[name].get();
+		// start decoding now; loadTextures() waits for it
+		std::shared_ptr<TextureMap> texture = TextureCache::instance().get(name);
+		TextureCache::instance().prefetch(texture);
+		textureCache[name] = texture;
+		return texture.get();
 	}
 	return itr->second.get();
 }
 
+void Scene::loadTextures() {
+	for (auto& t : textureCache)
+		t.second->load();
+}
+
 // builds the kd tree
 void Scene::buildTree(int maxDepth, int leafSize) {
+	if (treeBuilt && treeGeneration == generation &&
+	    treeMaxDepth == maxDepth && treeLeafSize == leafSize)
+		return;
+
 	// switch to normal ptrs
 	std::vector<Geometry*> tempObjects;
 	for (auto const& o : objects) {
 		tempObjects.emplace_back(o.get());
 	}
 	
-	kdtree->buildTree(tempObjects, sceneBounds, maxDepth, leafSize);
+	KdTreeKey key;
+	key.sourceHash = treeSourceHash;
+	key.sceneVersion = SceneCache::VERSION;
+	key.sceneOptions = treeSceneOptions;
+	key.objectCount = (uint32_t)tempObjects.size();
+	key.maxDepth = maxDepth;
+	key.leafSize = leafSize;
+	if (treeCacheFile.empty() || !kdtree->load(treeCacheFile, tempObjects, key)) {
+		kdtree->buildTree(tempObjects, sceneBounds, maxDepth, leafSize);
+		if (!treeCacheFile.empty())
+			kdtree->save(treeCacheFile, key);
+	}
+
+	treeBuilt = true;
+	treeGeneration = generation;
+	treeMaxDepth = maxDepth;
+	treeLeafSize = leafSize;
 }
 
@@ -10,16 +10,20 @@
 #define __SCENE_H__
 
 #include <algorithm>
+#include <limits>
 #include <map>
 #include <memory>
 #include <string>
 #include <vector>
 #include <mutex>
+#include <stdint.h>
 
 #include "bbox.h"
 #include "camera.h"
 #include "material.h"
 #include "ray.h"
+#include "lightIndex.h"
+#include "renderSettings.h"
 
 #include <glm/geometric.hpp>
 #include <glm/mat3x3.hpp>
@@ -62,6 +66,7 @@ inline glm::dvec3 operator*(const glm::dmat4x4& mat, const glm::dvec3& vec)
 }
 
 class TransformNode {
+	friend class SceneCache;
 protected:
 	// information about this node's transformation
 	glm::dmat4x4 xform;
@@ -90,28 +95,42 @@ public:
 	}
 
 	// Coordinate-Space transformation
-	glm::dvec3 globalToLocalCoords(const glm::dvec3& v)
+	glm::dvec3 globalToLocalCoords(const glm::dvec3& v) const
 	{
 		return inverse * v;
 	}
 
-	glm::dvec3 localToGlobalCoords(const glm::dvec3& v)
+	glm::dvec3 localToGlobalCoords(const glm::dvec3& v) const
 	{
 		return xform * v;
 	}
 
-	glm::dvec4 localToGlobalCoords(const glm::dvec4& v)
+	glm::dvec4 localToGlobalCoords(const glm::dvec4& v) const
 	{
 		return xform * v;
 	}
 
-	glm::dvec3 localToGlobalCoordsNormal(const glm::dvec3& v)
+	glm::dvec3 localToGlobalCoordsNormal(const glm::dvec3& v) const
 	{
 		return glm::normalize(normi * v);
 	}
 
 	const glm::dmat4x4& transform() const { return xform; }
 
+	// What the transform amounts to, worked out once when the node is
+	// made so that Geometry::intersect can skip the matrix work for
+	// the common cases.
+	enum Kind {
+		IDENTITY,      // leaves everything where it is
+		TRANSLATE,     // moves by offset()
+		UNIFORM_SCALE, // scales by scale() > 0, then moves by offset()
+		GENERAL        // anything else
+	};
+
+	Kind kind() const { return xformKind; }
+	const glm::dvec3& offset() const { return xformOffset; }
+	double scale() const { return xformScale; }
+
 protected:
 	// protected so that users can't directly construct one of these...
 	// force them to use the createChild() method.  Note that they CAN
@@ -126,7 +145,15 @@ protected:
 			this->xform = parent->xform * xform;
 		inverse = glm::inverse(this->xform);
 		normi = glm::transpose(glm::inverse(glm::dmat3x3(this->xform)));
+		classify();
 	}
+
+	// set kind, offset and scale from xform
+	void classify();
+
+	Kind xformKind;
+	glm::dvec3 xformOffset;
+	double xformScale;
 };
 
 class TransformRoot : public TransformNode {
@@ -138,14 +165,23 @@ public:
 // It may not be an actual visible scene object.  For example, hierarchical
 // spatial subdivision could be expressed in terms of Geometry instances.
 class Geometry : public SceneElement {
+	friend class SceneCache;
 protected:
 	// intersections performed in the object's local coordinate space
 	// do not call directly - this should only be called by intersect()
 	virtual bool intersectLocal(ray& r, isect& i) const = 0;
 
+private:
+	// intersectLocal on r taken into the object's space, with the hit
+	// brought back out; intersect() without the bounding box and tMax.
+	bool intersectGlobal(ray& r, isect& i) const;
+
 public:
-	// intersections performed in the global coordinate space.
-	bool intersect(ray& r, isect& i) const;
+	// intersections performed in the global coordinate space.  Only
+	// hits nearer than tMax count; pass the nearest hit found so far
+	// and the object's bounding box can rule it out without a test.
+	bool intersect(ray& r, isect& i,
+	               double tMax = std::numeric_limits<double>::infinity()) const;
 
 	virtual bool hasBoundingBoxCapability() const;
 	const BoundingBox& getBoundingBox() const { return bounds; }
@@ -162,6 +198,7 @@ public:
 	{
 		this->transform = transform;
 	};
+	TransformNode* getTransform() const { return transform; }
 
 	Geometry(Scene* scene) : SceneElement(scene) {}
 
@@ -201,6 +238,7 @@ protected:
 // A simple extension of SceneObject that adds an instance of Material
 // for simple material bindings.
 class MaterialSceneObject : public SceneObject {
+	friend class SceneCache;
 public:
 	virtual ~MaterialSceneObject() {}
 
@@ -231,11 +269,33 @@ public:
 	void add(Geometry* obj);
 	void add(Light* light);
 
-	bool intersect(ray& r, isect& i) const;
+	// The nearest hit along r before tMax, if there is one.
+	bool intersect(ray& r, isect& i,
+	               double tMax = std::numeric_limits<double>::infinity()) const;
+	// The same, compiled for one setting of the kd-tree and debugging
+	// switches; the render loop calls the one matching its settings.
+	template<bool UseTree, bool Debug>
+	bool intersect(ray& r, isect& i,
+	               double tMax = std::numeric_limits<double>::infinity()) const;
+
+	// The settings of the render in progress.  Set by
+	// RayTracer::traceSetup before any rays are traced.
+	void setRenderSettings(const RenderSettings& s);
+	const RenderSettings& renderSettings() const { return settings; }
+	// Changes every time the settings are set, in every scene; what
+	// is remembered between rays of one render (ShadowCache) is kept
+	// only while it stays the same.
+	uint64_t renderEpoch() const { return epoch; }
 
 	auto beginLights() const { return lights.begin(); }
 	auto endLights() const { return lights.end(); }
 	const auto& getAllLights() const { return lights; }
+	// The lights that can add the render threshold or more at p, in
+	// the order getAllLights() has them.
+	const std::vector<const Light*>& lightsAt(const glm::dvec3& p) const
+	{
+		return lightIndex.lightsAt(p);
+	}
 
 	auto beginObjects() const { return objects.cbegin(); }
 	auto endObjects() const { return objects.cend(); }
@@ -243,11 +303,17 @@ public:
 	const Camera& getCamera() const { return camera; }
 	Camera& getCamera() { return camera; }
 
-	// For efficiency reasons, we'll store texture maps in a cache
-	// in the Scene.  This makes sure they get deleted when the scene
-	// is destroyed.
+	// Texture maps come from the process-wide TextureCache, so scenes
+	// that use the same image share one copy.  The scene holds a
+	// reference to each of its textures, which keeps them alive for
+	// as long as the scene is.
 	TextureMap* getTexture(string name);
 
+	// Wait for the textures to finish decoding; getTexture() starts
+	// them in the background.  Throws TextureMapException if an
+	// image cannot be read.
+	void loadTextures();
+
 	// These two functions are for handling ambient light; in the Phong
 	// model,
 	// the "ambient" light is considered a property of the _scene_ as a
@@ -264,8 +330,22 @@ public:
 
 	const BoundingBox& bounds() const { return sceneBounds; }
 
+	// Build the kd-tree, unless it was already built with these
+	// parameters and no geometry has been added since.
 	void buildTree(int maxDepth, int leafSize);
 
+	// Keep built trees in treeFile, keyed by the hash of the scene
+	// text and the SceneCache options it was loaded with, and map them
+	// back instead of building when the scene and tree parameters
+	// match.  An empty name turns this off.
+	void setTreeCache(const std::string& treeFile, uint64_t sourceHash,
+	                  uint32_t sceneOptions)
+	{
+		treeCacheFile = treeFile;
+		treeSourceHash = sourceHash;
+		treeSceneOptions = sceneOptions;
+	}
+
 private:
 	std::vector<std::unique_ptr<Geometry>> objects;
 	std::vector<std::unique_ptr<Light>> lights;
@@ -275,7 +355,7 @@ private:
 	// (used as the I_a in the Phong shading model)
 	glm::dvec3 ambientIntensity;
 
-	typedef std::map<std::string, std::unique_ptr<TextureMap>> tmap;
+	typedef std::map<std::string, std::shared_ptr<TextureMap>> tmap;
 	tmap textureCache;
 
 	// Each object in the scene, provided that it has
@@ -285,7 +365,22 @@ private:
 	// are exempt from this requirement.
 	BoundingBox sceneBounds;
 
+	RenderSettings settings;
+	uint64_t epoch = 0;
+	LightIndex lightIndex;
+
 	KdTree<Geometry>* kdtree;
+	std::string treeCacheFile;
+	uint64_t treeSourceHash = 0;
+	uint32_t treeSceneOptions = 0;
+
+	// bumped whenever geometry is added; the tree is current if it was
+	// built at this generation with the same parameters
+	uint64_t generation = 0;
+	bool treeBuilt = false;
+	uint64_t treeGeneration = 0;
+	int treeMaxDepth = 0;
+	int treeLeafSize = 0;
 
 	mutable std::mutex intersectionCacheMutex;
 
@@ -0,0 +1,697 @@
+#include "sceneCache.h"
+
+#include "scene.h"
+#include "light.h"
+#include "material.h"
+#include "../fileio/mappedFile.h"
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/Square.h"
+#include "../SceneObjects/trimesh.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <vector>
+
+using std::string;
+
+/*
+   Layout, all in native byte order:
+
+     header     magic, version, byte order mark, source hash, options
+     camera     the Camera's fields as they are in memory
+     ambient    the scene's ambient intensity
+     lights     count, then a tag and the fields of each light
+     transforms count, then each node's xform, inverse and normal matrix
+     meshes     count, then per trimesh: transform, material, vertices,
+                normals, per-vertex materials and face index triples
+     objects    count, then a tag per object in scene order; runs of
+                trimesh faces are stored as (mesh, first, count)
+
+   Counts are uint32, strings are a uint32 length and the bytes.
+*/
+
+namespace {
+
+const char MAGIC[8] = { 'S', 'B', 'T', 'S', 'C', 'E', 'N', 'E' };
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+enum ObjectTag : uint8_t {
+	TAG_SPHERE = 1,
+	TAG_BOX,
+	TAG_SQUARE,
+	TAG_CYLINDER,
+	TAG_CONE,
+	TAG_FACES
+};
+
+enum LightTag : uint8_t {
+	TAG_DIRECTIONAL_LIGHT = 1,
+	TAG_POINT_LIGHT
+};
+
+// thrown when the cache is truncated or doesn't make sense
+struct CorruptCache {};
+
+// thrown when the scene holds something save() can't describe
+struct Unsupported {};
+
+} // anonymous namespace
+
+class SceneCache::Writer {
+public:
+	Writer(const string& basePath) : basePath(basePath) {}
+
+	template <typename T> void put(const T& v)
+	{
+		putBytes(&v, sizeof(T));
+	}
+
+	void putBytes(const void* p, size_t n)
+	{
+		const char* c = (const char*)p;
+		bytes.insert(bytes.end(), c, c + n);
+	}
+
+	void putCount(size_t n) { put<uint32_t>((uint32_t)n); }
+
+	void putString(const string& s)
+	{
+		putCount(s.size());
+		putBytes(s.data(), s.size());
+	}
+
+	void header(uint64_t sourceHash, uint32_t options)
+	{
+		putBytes(MAGIC, sizeof(MAGIC));
+		put<uint32_t>(VERSION);
+		put<uint32_t>(BYTE_ORDER_MARK);
+		put<uint64_t>(sourceHash);
+		put<uint32_t>(options);
+	}
+
+	void camera(const Camera& c)
+	{
+		put(c.m);
+		put(c.normalizedHeight);
+		put(c.aspectRatio);
+		put(c.eye);
+		put(c.look);
+		put(c.u);
+		put(c.v);
+	}
+
+	void light(const Light* l)
+	{
+		if (auto d = dynamic_cast<const DirectionalLight*>(l)) {
+			put<uint8_t>(TAG_DIRECTIONAL_LIGHT);
+			put(d->color);
+			put(d->orientation);
+		} else if (auto p = dynamic_cast<const PointLight*>(l)) {
+			put<uint8_t>(TAG_POINT_LIGHT);
+			put(p->color);
+			put(p->position);
+			put(p->constantTerm);
+			put(p->linearTerm);
+			put(p->quadraticTerm);
+		} else {
+			throw Unsupported();
+		}
+	}
+
+	void parameter(const MaterialParameter& p)
+	{
+		put(p._value);
+		// store texture names relative to the scene where possible,
+		// so the cache still works if the scene is opened from
+		// another directory
+		string name;
+		uint8_t relative = 0;
+		if (p._textureMap) {
+			name = p._textureMap->getFilename();
+			string prefix = basePath + "/";
+			if (name.compare(0, prefix.size(), prefix) == 0) {
+				name = name.substr(prefix.size());
+				relative = 1;
+			}
+		}
+		put(relative);
+		putString(name);
+	}
+
+	void material(const Material& m)
+	{
+		if (geometryOnly)
+			return;
+		parameter(m._ke);
+		parameter(m._ka);
+		parameter(m._ks);
+		parameter(m._kd);
+		parameter(m._kr);
+		parameter(m._kt);
+		parameter(m._shininess);
+		parameter(m._index);
+		put<uint8_t>(m._refl);
+		put<uint8_t>(m._trans);
+		put<uint8_t>(m._recur);
+		put<uint8_t>(m._spec);
+		put<uint8_t>(m._both);
+	}
+
+	void transformRef(const TransformNode* t)
+	{
+		put<uint32_t>(transformIndex.at(t));
+	}
+
+	void addTransform(const TransformNode* t)
+	{
+		if (transformIndex.count(t))
+			return;
+		transformIndex[t] = (uint32_t)transforms.size();
+		transforms.push_back(t);
+	}
+
+	void transformTable()
+	{
+		putCount(transforms.size());
+		for (auto t : transforms) {
+			put(t->xform);
+			put(t->inverse);
+			put(t->normi);
+		}
+	}
+
+	void mesh(const Trimesh* t)
+	{
+		transformRef(t->transform);
+		material(*t->material);
+		put<uint8_t>(t->vertNorms);
+
+		putCount(t->vertices.size());
+		putBytes(t->vertices.data(), t->vertices.size() * sizeof(glm::dvec3));
+		putCount(t->normals.size());
+		putBytes(t->normals.data(), t->normals.size() * sizeof(glm::dvec3));
+		putCount(t->materials.size());
+		for (auto m : t->materials)
+			material(*m);
+
+		putCount(t->faces.size());
+		for (auto f : t->faces)
+			putBytes(f->ids, sizeof(f->ids));
+	}
+
+	void object(const Geometry* g)
+	{
+		uint8_t tag;
+		if (dynamic_cast<const Sphere*>(g))
+			tag = TAG_SPHERE;
+		else if (dynamic_cast<const Box*>(g))
+			tag = TAG_BOX;
+		else if (dynamic_cast<const Square*>(g))
+			tag = TAG_SQUARE;
+		else if (dynamic_cast<const Cylinder*>(g))
+			tag = TAG_CYLINDER;
+		else if (dynamic_cast<const Cone*>(g))
+			tag = TAG_CONE;
+		else
+			throw Unsupported();
+
+		auto o = static_cast<const MaterialSceneObject*>(g);
+		put(tag);
+		transformRef(o->transform);
+		material(*o->material);
+		if (tag == TAG_CYLINDER) {
+			put<uint8_t>(static_cast<const Cylinder*>(g)->capped);
+		} else if (tag == TAG_CONE) {
+			auto c = static_cast<const Cone*>(g);
+			put(c->height);
+			put(c->b_radius);
+			put(c->t_radius);
+			put<uint8_t>(c->capped);
+		}
+	}
+
+	void faceRun(uint32_t mesh, uint32_t first, uint32_t count)
+	{
+		put<uint8_t>(TAG_FACES);
+		put(mesh);
+		put(first);
+		put(count);
+	}
+
+	// The transforms, meshes and objects, in scene order.
+	void geometry(const Scene& scene)
+	{
+		// Gather the meshes and transforms first so the objects can
+		// refer to them by index.
+		std::vector<const Trimesh*> meshes;
+		std::map<const Trimesh*, uint32_t> meshIndex;
+		for (auto it = scene.beginObjects(); it != scene.endObjects(); ++it) {
+			const Geometry* g = it->get();
+			if (auto f = dynamic_cast<const TrimeshFace*>(g)) {
+				if (!meshIndex.count(f->parent)) {
+					meshIndex[f->parent] = (uint32_t)meshes.size();
+					meshes.push_back(f->parent);
+					addTransform(f->parent->transform);
+				}
+			} else {
+				addTransform(g->transform);
+			}
+		}
+
+		transformTable();
+
+		putCount(meshes.size());
+		for (auto t : meshes)
+			mesh(t);
+
+		// Count the records first: runs of faces of one mesh, in the
+		// order the parser added them, collapse into one.
+		struct Record {
+			const Geometry* object;
+			uint32_t mesh, first, count;
+		};
+		std::vector<Record> records;
+		for (auto it = scene.beginObjects(); it != scene.endObjects(); ++it) {
+			const Geometry* g = it->get();
+			auto f = dynamic_cast<const TrimeshFace*>(g);
+			if (!f) {
+				records.push_back({ g, 0, 0, 0 });
+				continue;
+			}
+			uint32_t mesh = meshIndex[f->parent];
+			const auto& faces = f->parent->faces;
+			if (!records.empty()) {
+				Record& last = records.back();
+				if (!last.object && last.mesh == mesh &&
+				    last.first + last.count < faces.size() &&
+				    faces[last.first + last.count] == f) {
+					last.count++;
+					continue;
+				}
+			}
+			auto pos = std::find(faces.begin(), faces.end(), f);
+			if (pos == faces.end())
+				throw Unsupported();
+			records.push_back({ nullptr, mesh, (uint32_t)(pos - faces.begin()), 1 });
+		}
+
+		putCount(records.size());
+		for (auto& r : records) {
+			if (r.object)
+				object(r.object);
+			else
+				faceRun(r.mesh, r.first, r.count);
+		}
+	}
+
+	std::vector<char> bytes;
+	// leave materials out, for geometryHash
+	bool geometryOnly = false;
+
+private:
+	string basePath;
+	std::map<const TransformNode*, uint32_t> transformIndex;
+	std::vector<const TransformNode*> transforms;
+};
+
+class SceneCache::Reader {
+public:
+	Reader(const char* data, size_t length, Scene* scene, const string& basePath)
+	        : cur(data), end(data + length), scene(scene), basePath(basePath)
+	{
+	}
+
+	~Reader()
+	{
+		// only left over if loading failed part way
+		for (auto g : pending)
+			delete g;
+		for (auto t : meshes)
+			delete t;
+	}
+
+	template <typename T> T get()
+	{
+		T v;
+		getBytes(&v, sizeof(T));
+		return v;
+	}
+
+	template <typename T> void get(T& v) { getBytes(&v, sizeof(T)); }
+
+	void getBytes(void* p, size_t n)
+	{
+		if ((size_t)(end - cur) < n)
+			throw CorruptCache();
+		memcpy(p, cur, n);
+		cur += n;
+	}
+
+	// a count of elements at least minSize bytes each, checked against
+	// what's left so a damaged count can't ask for a huge allocation
+	size_t getCount(size_t minSize)
+	{
+		size_t n = get<uint32_t>();
+		if (n * minSize > (size_t)(end - cur))
+			throw CorruptCache();
+		return n;
+	}
+
+	string getString()
+	{
+		size_t n = getCount(1);
+		string s(cur, n);
+		cur += n;
+		return s;
+	}
+
+	bool header(uint64_t sourceHash, uint32_t options)
+	{
+		char magic[sizeof(MAGIC)];
+		getBytes(magic, sizeof(magic));
+		if (memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+			return false;
+		if (get<uint32_t>() != VERSION || get<uint32_t>() != BYTE_ORDER_MARK)
+			return false;
+		if (get<uint64_t>() != sourceHash)
+			return false;
+		return get<uint32_t>() == options;
+	}
+
+	void camera(Camera& c)
+	{
+		get(c.m);
+		get(c.normalizedHeight);
+		get(c.aspectRatio);
+		get(c.eye);
+		get(c.look);
+		get(c.u);
+		get(c.v);
+	}
+
+	Light* light()
+	{
+		uint8_t tag = get<uint8_t>();
+		glm::dvec3 color = get<glm::dvec3>();
+		if (tag == TAG_DIRECTIONAL_LIGHT) {
+			glm::dvec3 orientation = get<glm::dvec3>();
+			auto d = new DirectionalLight(scene, orientation, color);
+			d->orientation = orientation;
+			return d;
+		}
+		if (tag == TAG_POINT_LIGHT) {
+			glm::dvec3 position = get<glm::dvec3>();
+			float a = get<float>();
+			float b = get<float>();
+			float c = get<float>();
+			return new PointLight(scene, position, color, a, b, c);
+		}
+		throw CorruptCache();
+	}
+
+	void parameter(MaterialParameter& p)
+	{
+		get(p._value);
+		uint8_t relative = get<uint8_t>();
+		string name = getString();
+		if (name.empty()) {
+			p._textureMap = 0;
+			return;
+		}
+		if (relative)
+			name = basePath + "/" + name;
+		p._textureMap = scene->getTexture(name);
+	}
+
+	Material* material()
+	{
+		std::unique_ptr<Material> m(new Material);
+		parameter(m->_ke);
+		parameter(m->_ka);
+		parameter(m->_ks);
+		parameter(m->_kd);
+		parameter(m->_kr);
+		parameter(m->_kt);
+		parameter(m->_shininess);
+		parameter(m->_index);
+		m->_refl = get<uint8_t>() != 0;
+		m->_trans = get<uint8_t>() != 0;
+		m->_recur = get<uint8_t>() != 0;
+		m->_spec = get<uint8_t>() != 0;
+		m->_both = get<uint8_t>() != 0;
+		return m.release();
+	}
+
+	void transformTable()
+	{
+		size_t n = getCount(sizeof(glm::dmat4x4));
+		transforms.reserve(n);
+		for (size_t i = 0; i < n; i++) {
+			TransformNode* t = scene->transformRoot.createChild(glm::dmat4x4(1.0));
+			get(t->xform);
+			get(t->inverse);
+			get(t->normi);
+			t->classify();
+			transforms.push_back(t);
+		}
+	}
+
+	TransformNode* transformRef()
+	{
+		uint32_t i = get<uint32_t>();
+		if (i >= transforms.size())
+			throw CorruptCache();
+		return transforms[i];
+	}
+
+	void mesh()
+	{
+		TransformNode* transform = transformRef();
+		Trimesh* t = new Trimesh(scene, nullptr, transform);
+		meshes.push_back(t);
+		t->setMaterial(material());
+		t->vertNorms = get<uint8_t>() != 0;
+
+		t->vertices.resize(getCount(sizeof(glm::dvec3)));
+		getBytes(t->vertices.data(), t->vertices.size() * sizeof(glm::dvec3));
+		t->normals.resize(getCount(sizeof(glm::dvec3)));
+		getBytes(t->normals.data(), t->normals.size() * sizeof(glm::dvec3));
+		size_t materials = getCount(1);
+		t->materials.reserve(materials);
+		for (size_t i = 0; i < materials; i++)
+			t->materials.push_back(material());
+
+		size_t faces = getCount(3 * sizeof(int));
+		t->faces.reserve(faces);
+		for (size_t i = 0; i < faces; i++) {
+			int ids[3];
+			getBytes(ids, sizeof(ids));
+			size_t before = t->faces.size();
+			if (!t->addFace(ids[0], ids[1], ids[2]) || t->faces.size() != before + 1)
+				throw CorruptCache();
+		}
+	}
+
+	void object()
+	{
+		uint8_t tag = get<uint8_t>();
+		if (tag == TAG_FACES) {
+			uint32_t mesh = get<uint32_t>();
+			uint32_t first = get<uint32_t>();
+			uint32_t count = get<uint32_t>();
+			if (mesh >= meshes.size() ||
+			    (uint64_t)first + count > meshes[mesh]->faces.size())
+				throw CorruptCache();
+			for (uint32_t i = first; i < first + count; i++)
+				pendingFaces.push_back(meshes[mesh]->faces[i]);
+			pending.push_back(nullptr);    // placeholder for the run
+			runs.push_back(count);
+			return;
+		}
+
+		TransformNode* transform = transformRef();
+		std::unique_ptr<Material> mat(material());
+		MaterialSceneObject* o;
+		switch (tag) {
+		case TAG_SPHERE:
+			o = new Sphere(scene, mat.release());
+			break;
+		case TAG_BOX:
+			o = new Box(scene, mat.release());
+			break;
+		case TAG_SQUARE:
+			o = new Square(scene, mat.release());
+			break;
+		case TAG_CYLINDER: {
+			Cylinder* c = new Cylinder(scene, mat.release());
+			c->capped = get<uint8_t>() != 0;
+			o = c;
+			break;
+		}
+		case TAG_CONE: {
+			double h = get<double>();
+			double br = get<double>();
+			double tr = get<double>();
+			bool capped = get<uint8_t>() != 0;
+			o = new Cone(scene, mat.release(), h, br, tr, capped);
+			break;
+		}
+		default:
+			throw CorruptCache();
+		}
+		o->setTransform(transform);
+		pending.push_back(o);
+	}
+
+	// everything was read; hand the objects to the scene in order
+	void finish()
+	{
+		if (cur != end)
+			throw CorruptCache();
+		size_t run = 0, face = 0;
+		for (auto g : pending) {
+			if (g) {
+				scene->add(g);
+				continue;
+			}
+			for (uint32_t i = 0; i < runs[run]; i++)
+				scene->add(pendingFaces[face++]);
+			run++;
+		}
+		pending.clear();
+		// The scene now owns the faces.  Like the parser, leave the
+		// meshes themselves to the faces that point at them.
+		meshes.clear();
+	}
+
+private:
+	const char* cur;
+	const char* end;
+	Scene* scene;
+	string basePath;
+
+	std::vector<TransformNode*> transforms;
+	std::vector<Trimesh*> meshes;
+	std::vector<Geometry*> pending;
+	std::vector<Geometry*> pendingFaces;
+	std::vector<uint32_t> runs;
+};
+
+const uint32_t SceneCache::VERSION;
+
+uint64_t SceneCache::hash(const char* data, size_t length)
+{
+	// 64-bit FNV-1a
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < length; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+uint64_t SceneCache::geometryHash(const Scene& scene)
+{
+	Writer out("");
+	out.geometryOnly = true;
+	try {
+		out.geometry(scene);
+	} catch (Unsupported&) {
+		return 0;
+	}
+	return hash(out.bytes.data(), out.bytes.size());
+}
+
+string SceneCache::cacheFileFor(const string& sceneFile)
+{
+	return sceneFile + ".cache";
+}
+
+string SceneCache::treeFileFor(const string& sceneFile)
+{
+	return sceneFile + ".kdtree";
+}
+
+Scene* SceneCache::load(const string& cacheFile, const string& basePath,
+                        uint64_t sourceHash, uint32_t options)
+{
+	MappedFile file(cacheFile);
+	if (!file.isOpen())
+		return nullptr;
+
+	std::unique_ptr<Scene> scene(new Scene);
+	try {
+		Reader in(file.data(), file.size(), scene.get(), basePath);
+		if (!in.header(sourceHash, options))
+			return nullptr;
+
+		in.camera(scene->getCamera());
+		scene->addAmbient(in.get<glm::dvec3>());
+
+		size_t lights = in.getCount(1);
+		for (size_t i = 0; i < lights; i++)
+			scene->add(in.light());
+
+		in.transformTable();
+
+		size_t meshes = in.getCount(1);
+		for (size_t i = 0; i < meshes; i++)
+			in.mesh();
+
+		size_t objects = in.getCount(1);
+		for (size_t i = 0; i < objects; i++)
+			in.object();
+		in.finish();
+	} catch (CorruptCache&) {
+		return nullptr;
+	}
+	return scene.release();
+}
+
+bool SceneCache::save(const Scene& scene, const string& cacheFile,
+                      const string& basePath, uint64_t sourceHash,
+                      uint32_t options)
+{
+	Writer out(basePath);
+
+	try {
+		out.header(sourceHash, options);
+		out.camera(scene.getCamera());
+		out.put(scene.ambient());
+
+		out.putCount(scene.getAllLights().size());
+		for (auto& l : scene.getAllLights())
+			out.light(l.get());
+
+		out.geometry(scene);
+	} catch (Unsupported&) {
+		return false;
+	}
+
+	// Write to a temporary name and rename it into place, so a reader
+	// never maps a half-written cache.
+	string tmp = cacheFile + ".tmp";
+	{
+		std::ofstream f(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!f)
+			return false;
+		f.write(out.bytes.data(), out.bytes.size());
+		if (!f) {
+			f.close();
+			remove(tmp.c_str());
+			return false;
+		}
+	}
+	if (rename(tmp.c_str(), cacheFile.c_str()) != 0) {
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
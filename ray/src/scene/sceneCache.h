@@ -0,0 +1,70 @@
+#ifndef __SCENECACHE_H__
+#define __SCENECACHE_H__
+
+#include <stdint.h>
+#include <string>
+
+class Scene;
+
+/*
+   SceneCache saves a parsed scene as a compact binary file next to
+   its .ray source (foo.ray -> foo.ray.cache), so that re-rendering
+   the same scene maps that file and rebuilds the objects from it
+   instead of tokenizing and parsing the text again.
+
+   The cache holds the camera, lights, transforms, materials and the
+   trimesh vertex and index buffers.  It is keyed by a hash of the
+   source text; a cache written for different text, by a different
+   version of the format or on a machine with different byte order
+   is ignored, and load() returns NULL so the caller parses as usual.
+
+   Texture maps are stored by name, relative to the scene's directory,
+   and are fetched through the TextureCache when the scene is rebuilt.
+*/
+class SceneCache {
+public:
+	// Bump whenever the layout written by save() changes, or the order
+	// objects are added to the scene in; saved kd-trees depend on it.
+	static const uint32_t VERSION = 3;
+
+	// Load-time options that change what the parse produces; a cache
+	// is only used with the options it was written with.
+	enum Options {
+		BAKED_MESHES = 1	// trimeshes moved into world space
+	};
+
+	// Hash of the scene source, used to key the cache.
+	static uint64_t hash(const char* data, size_t length);
+
+	// Hash of the scene's objects, their shapes and where they are,
+	// but not their materials, the lights or the camera: two scenes
+	// with the same hash put the same object, in the same place in
+	// scene order, at every point.  0 if save() couldn't describe the
+	// scene.
+	static uint64_t geometryHash(const Scene& scene);
+
+	static std::string cacheFileFor(const std::string& sceneFile);
+
+	// Where Scene::buildTree keeps the scene's kd-tree.
+	static std::string treeFileFor(const std::string& sceneFile);
+
+	// Rebuild a scene from cacheFile if it was written for a source
+	// with this hash and these options, otherwise return NULL.
+	// basePath is the scene's directory, as given to the Parser.
+	static Scene* load(const std::string& cacheFile,
+	                   const std::string& basePath, uint64_t sourceHash,
+	                   uint32_t options);
+
+	// Write scene to cacheFile.  Returns false, leaving no file behind,
+	// if the scene holds something the format can't describe or the
+	// file can't be written.
+	static bool save(const Scene& scene, const std::string& cacheFile,
+	                 const std::string& basePath, uint64_t sourceHash,
+	                 uint32_t options);
+
+private:
+	class Writer;
+	class Reader;
+};
+
+#endif // __SCENECACHE_H__
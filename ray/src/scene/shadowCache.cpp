@@ -0,0 +1,89 @@
+#include <atomic>
+#include <vector>
+
+#include "shadowCache.h"
+#include "scene.h"
+
+// What one thread remembers.  The counts go into the totals when the
+// thread ends, so threads don't fight over them while rendering.
+struct ThreadShadows {
+	uint64_t epoch = 0;
+	std::vector<const Geometry*> occluders;	// by light number
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+
+	~ThreadShadows();
+};
+
+static std::atomic<uint64_t> totalHits(0);
+static std::atomic<uint64_t> totalMisses(0);
+static thread_local ThreadShadows shadows;
+
+ThreadShadows::~ThreadShadows()
+{
+	ShadowCache::flushStats();
+}
+
+// This thread's entries, emptied if the scene has been set up for a
+// render since they were made.  A scene that never has been (epoch 0)
+// gets no entries at all.
+static ThreadShadows& threadShadows(const Scene* scene)
+{
+	if (shadows.epoch != scene->renderEpoch()) {
+		shadows.epoch = scene->renderEpoch();
+		shadows.occluders.clear();
+	}
+	return shadows;
+}
+
+const Geometry* ShadowCache::lastOccluder(const Scene* scene, int n)
+{
+	if (!scene->renderEpoch())
+		return nullptr;
+	ThreadShadows& t = threadShadows(scene);
+	return n >= 0 && n < (int)t.occluders.size() ? t.occluders[n] : nullptr;
+}
+
+void ShadowCache::remember(const Scene* scene, int n, const Geometry* occluder)
+{
+	if (n < 0 || !scene->renderEpoch())
+		return;
+	ThreadShadows& t = threadShadows(scene);
+	if (n >= (int)t.occluders.size())
+		t.occluders.resize(n + 1, nullptr);
+	t.occluders[n] = occluder;
+}
+
+void ShadowCache::count(bool hit)
+{
+	if (hit)
+		shadows.hits++;
+	else
+		shadows.misses++;
+}
+
+void ShadowCache::flushStats()
+{
+	totalHits += shadows.hits;
+	totalMisses += shadows.misses;
+	shadows.hits = 0;
+	shadows.misses = 0;
+}
+
+uint64_t ShadowCache::hits()
+{
+	return totalHits + shadows.hits;
+}
+
+uint64_t ShadowCache::misses()
+{
+	return totalMisses + shadows.misses;
+}
+
+void ShadowCache::resetStats()
+{
+	totalHits = 0;
+	totalMisses = 0;
+	shadows.hits = 0;
+	shadows.misses = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef __SHADOWCACHE_H__
+#define __SHADOWCACHE_H__
+
+#include <stdint.h>
+
+class Geometry;
+class Scene;
+
+/*
+   ShadowCache remembers, for each render thread and each light, the
+   object that last blocked a shadow ray toward that light.  Shadow
+   rays from neighbouring points usually hit the same object, so the
+   light tests that one first; if it still blocks the ray, the full
+   search only has to look for something nearer than where it was
+   hit.  See Light::findOccluder.
+
+   Entries are per thread, so there is no locking.  They are tied to
+   the scene's render epoch, which changes whenever its render
+   settings are set: when a scene is loaded or the settings change
+   (RayTracer::syncSettings).  Entries from another epoch are
+   dropped, so they never point into a scene that has been replaced,
+   while renders of an unchanged scene keep them.
+*/
+class ShadowCache {
+public:
+	// The object that last blocked light number n on this thread, or
+	// NULL.
+	static const Geometry* lastOccluder(const Scene* scene, int n);
+	static void remember(const Scene* scene, int n, const Geometry* occluder);
+
+	// Count one shadow ray that found its remembered occluder still
+	// in the way (hit), or didn't (miss).
+	static void count(bool hit);
+
+	// Add this thread's counts to the totals, as happens anyway when
+	// it ends; render threads that are kept call this after each job.
+	static void flushStats();
+
+	// Totals over threads that have finished or flushed, and this one.
+	static uint64_t hits();
+	static uint64_t misses();
+	static void resetStats();
+};
+
+#endif // __SHADOWCACHE_H__
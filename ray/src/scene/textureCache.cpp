@@ -0,0 +1,103 @@
+#include "textureCache.h"
+#include "material.h"
+
+#include <algorithm>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+TextureCache& TextureCache::instance()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+std::shared_ptr<TextureMap> TextureCache::get(const std::string& filename)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0) {
+		string error("Unable to load texture map '");
+		error.append(filename);
+		error.append("'.");
+		throw TextureMapException(error);
+	}
+
+	std::lock_guard<std::mutex> guard(cacheMutex);
+
+	// drop entries nobody references any more
+	for (auto it = entries.begin(); it != entries.end();) {
+		if (it->second.texture.expired())
+			it = entries.erase(it);
+		else
+			++it;
+	}
+
+	Entry& entry = entries[filename];
+	std::shared_ptr<TextureMap> texture = entry.texture.lock();
+	if (texture && entry.mtime == st.st_mtime && entry.bytes == (long long)st.st_size)
+		return texture;
+
+	// new file, or it changed on disk since we last decoded it
+	texture = std::make_shared<TextureMap>(filename);
+	entry.mtime = st.st_mtime;
+	entry.bytes = st.st_size;
+	entry.texture = texture;
+	return texture;
+}
+
+void TextureCache::prefetch(std::shared_ptr<TextureMap> texture)
+{
+	if (texture->isLoaded())
+		return;
+
+	std::lock_guard<std::mutex> guard(queueMutex);
+	if (decoders.empty()) {
+		unsigned n = std::max(std::thread::hardware_concurrency(), 1u);
+		for (unsigned i = 0; i < n; i++)
+			decoders.emplace_back(&TextureCache::decodeLoop, this);
+	}
+	decodeQueue.push_back(std::move(texture));
+	queueReady.notify_one();
+}
+
+void TextureCache::decodeLoop()
+{
+	for (;;) {
+		std::shared_ptr<TextureMap> texture;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueReady.wait(lock, [this] { return stopping || !decodeQueue.empty(); });
+			if (decodeQueue.empty())
+				return;
+			texture = std::move(decodeQueue.front());
+			decodeQueue.pop_front();
+		}
+		try {
+			texture->load();
+		} catch (TextureMapException&) {
+			// left for the foreground load() to report
+		}
+	}
+}
+
+TextureCache::~TextureCache()
+{
+	{
+		std::lock_guard<std::mutex> guard(queueMutex);
+		stopping = true;
+		decodeQueue.clear();
+	}
+	queueReady.notify_all();
+	for (auto& t : decoders)
+		t.join();
+}
+
+size_t TextureCache::size()
+{
+	std::lock_guard<std::mutex> guard(cacheMutex);
+	size_t live = 0;
+	for (const auto& e : entries)
+		if (!e.second.texture.expired())
+			++live;
+	return live;
+}
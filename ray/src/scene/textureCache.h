@@ -0,0 +1,70 @@
+#ifndef __TEXTURECACHE_H__
+#define __TEXTURECACHE_H__
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+
+class TextureMap;
+
+/*
+   TextureCache is a process-wide table of texture maps, shared by
+   every Scene and by the cube map.  Entries are keyed by path and
+   the file's modification time, and only hold weak references: a
+   texture lives as long as some scene or cube map still uses it,
+   so reloading a scene (which parses the new scene before dropping
+   the old one) picks up the already decoded images, while an edited
+   image on disk gets re-read.
+
+   The cache also owns a small pool of decoder threads.  prefetch()
+   queues a texture for decoding in the background, so the parser
+   can carry on while images are decoded in parallel; whoever calls
+   TextureMap::load() later either finds the work done or waits for
+   the decode already in flight.
+*/
+class TextureCache {
+public:
+	static TextureCache& instance();
+
+	// Find or create the texture for filename.  The image is not
+	// decoded until TextureMap::load() is first called on it.
+	// Throws TextureMapException if the file cannot be found.
+	std::shared_ptr<TextureMap> get(const std::string& filename);
+
+	// Start decoding texture on a pool thread, if it isn't decoded
+	// yet.  Errors are not reported here; load() rethrows them.
+	void prefetch(std::shared_ptr<TextureMap> texture);
+
+	// Number of live textures, for diagnostics.
+	size_t size();
+
+	~TextureCache();
+
+private:
+	TextureCache() : stopping(false) {}
+
+	void decodeLoop();
+
+	struct Entry {
+		time_t mtime;
+		long long bytes;
+		std::weak_ptr<TextureMap> texture;
+	};
+
+	std::mutex cacheMutex;
+	std::map<std::string, Entry> entries;
+
+	std::mutex queueMutex;
+	std::condition_variable queueReady;
+	std::deque<std::shared_ptr<TextureMap>> decodeQueue;
+	std::vector<std::thread> decoders;
+	bool stopping;
+};
+
+#endif // __TEXTURECACHE_H__
@@ -0,0 +1,98 @@
+#include "BatchManifest.h"
+
+#include <fstream>
+
+#include "json.hpp"
+using Json = nlohmann::json;
+
+namespace {
+
+bool readJson(const std::string& file, Json& json, std::string& error)
+{
+	std::ifstream fin(file);
+	if (!fin) {
+		error = "couldn't read " + file;
+		return false;
+	}
+	try {
+		fin >> json;
+	} catch (std::exception& e) {
+		error = file + ": " + e.what();
+		return false;
+	}
+	return true;
+}
+
+// Set value from field if the entry has it; false if it isn't a
+// string.
+bool loadString(const Json& entry, const char* field, std::string& value)
+{
+	auto it = entry.find(field);
+	if (it == entry.end())
+		return true;
+	if (!it->is_string())
+		return false;
+	value = it->get<std::string>();
+	return true;
+}
+
+// -1 if settings leave field alone, else its value as 0 or 1.
+int peekSwitch(const Json& settings, const char* field)
+{
+	auto it = settings.find(field);
+	if (it == settings.end() || !it->is_boolean())
+		return -1;
+	return it->get<bool>() ? 1 : 0;
+}
+
+} // anonymous namespace
+
+bool BatchManifest::load(const std::string& file, std::string& error)
+{
+	Json json;
+	if (!readJson(file, json, error))
+		return false;
+	if (!json.is_array()) {
+		error = "batch " + file + " should be a list of jobs";
+		return false;
+	}
+
+	jobList.clear();
+	for (const Json& entry : json) {
+		Job job;
+		if (entry.is_object() &&
+		    (!loadString(entry, "scene", job.scene) ||
+		     !loadString(entry, "output", job.output) ||
+		     !loadString(entry, "cubemap", job.cubemap))) {
+			error = "batch " + file + ": job " +
+			        std::to_string(jobList.size()) +
+			        " has bad \"scene\", \"output\" or \"cubemap\"";
+			return false;
+		}
+		if (job.scene.empty() || job.output.empty()) {
+			error = "batch " + file + ": job " +
+			        std::to_string(jobList.size()) +
+			        " needs \"scene\" and \"output\"";
+			return false;
+		}
+
+		auto settings = entry.find("settings");
+		if (settings != entry.end()) {
+			Json values = *settings;
+			if (settings->is_string() &&
+			    !readJson(settings->get<std::string>(), values, error))
+				return false;
+			if (!values.is_object()) {
+				error = "batch " + file + ": job " +
+				        std::to_string(jobList.size()) +
+				        " has bad \"settings\"";
+				return false;
+			}
+			job.settings = values.dump();
+			job.sceneCache = peekSwitch(values, "scene_cache");
+			job.bakeMeshes = peekSwitch(values, "bake_meshes");
+		}
+		jobList.push_back(job);
+	}
+	return true;
+}
@@ -0,0 +1,50 @@
+#ifndef __BATCHMANIFEST_H__
+#define __BATCHMANIFEST_H__
+
+#include <string>
+#include <vector>
+
+/*
+   BatchManifest is a list of renders for one run of the command line
+   (its -b option), read from a JSON file:
+
+     [
+       { "scene": "scenes/cube.ray", "output": "cube.png",
+         "settings": { "size": 800, "anti_alias": true } },
+       { "scene": "scenes/cube.ray", "output": "cube_sky.png",
+         "cubemap": "skies/posx.png" },
+       { "scene": "scenes/dragon.ray", "output": "dragon.png",
+         "settings": "fast.json" }
+     ]
+
+   Each job renders scene to output.  settings holds the same fields
+   as a -j file, or names one; they change what the jobs before left
+   in effect, so a list can vary one setting at a time.  cubemap is
+   one face of a cube map, as for -c, for this job and the ones after.
+   File names are taken as given, like those on the command line.
+*/
+class BatchManifest {
+public:
+	struct Job {
+		std::string scene;
+		std::string output;
+		std::string settings;	// JSON text of the settings, or empty
+		std::string cubemap;	// empty to keep the one in use
+		// scene_cache and bake_meshes as the settings set them, or -1
+		// if they leave them alone; they decide how the scene is read,
+		// which can start before the settings are put in effect
+		int sceneCache = -1;
+		int bakeMeshes = -1;
+	};
+
+	// Read the jobs from file.  Returns false, with a message in error,
+	// if the file can't be read or a job is missing scene or output.
+	bool load(const std::string& file, std::string& error);
+
+	const std::vector<Job>& jobs() const { return jobList; }
+
+private:
+	std::vector<Job> jobList;
+};
+
+#endif // __BATCHMANIFEST_H__
@@ -0,0 +1,91 @@
+#include "CameraPath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "json.hpp"
+using Json = nlohmann::json;
+
+namespace {
+
+// Set v from field, a list of three numbers, if the key has it.
+bool loadVec3(const Json& key, const char* field, glm::dvec3& v)
+{
+	auto it = key.find(field);
+	if (it == key.end())
+		return true;
+	if (!it->is_array() || it->size() != 3)
+		return false;
+	for (int a = 0; a < 3; a++) {
+		if (!(*it)[a].is_number())
+			return false;
+		v[a] = (*it)[a].get<double>();
+	}
+	return true;
+}
+
+} // anonymous namespace
+
+bool CameraPath::load(const std::string& file, const Key& start, std::string& error)
+{
+	std::ifstream fin(file);
+	if (!fin) {
+		error = "couldn't read camera path " + file;
+		return false;
+	}
+	Json json;
+	try {
+		fin >> json;
+	} catch (std::exception& e) {
+		error = "camera path " + file + ": " + e.what();
+		return false;
+	}
+
+	auto frames = json.is_object() ? json.find("frames") : json.end();
+	auto list = json.is_object() ? json.find("keys") : json.end();
+	if (frames == json.end() || !frames->is_number() ||
+	    frames->get<int>() < 1 || list == json.end() ||
+	    !list->is_array() || list->empty()) {
+		error = "camera path " + file + " needs \"frames\" and \"keys\"";
+		return false;
+	}
+	frameCount = frames->get<int>();
+
+	keys.clear();
+	Key k = start;
+	for (const Json& key : *list) {
+		auto fov = key.is_object() ? key.find("fov") : key.end();
+		if (!key.is_object() ||
+		    !loadVec3(key, "position", k.position) ||
+		    !loadVec3(key, "viewdir", k.viewDir) ||
+		    !loadVec3(key, "updir", k.upDir) ||
+		    (fov != key.end() && !fov->is_number())) {
+			error = "camera path " + file + ": bad key";
+			return false;
+		}
+		if (fov != key.end())
+			k.fov = fov->get<double>();
+		keys.push_back(k);
+	}
+	return true;
+}
+
+CameraPath::Key CameraPath::at(int f) const
+{
+	if (keys.size() == 1 || frameCount == 1)
+		return keys.front();
+
+	double s = double(f) / (frameCount - 1) * (keys.size() - 1);
+	size_t n = std::min((size_t)s, keys.size() - 2);
+	double w = s - n;
+	const Key& a = keys[n];
+	const Key& b = keys[n + 1];
+
+	Key k;
+	k.position = a.position + w * (b.position - a.position);
+	k.viewDir = a.viewDir + w * (b.viewDir - a.viewDir);
+	k.upDir = a.upDir + w * (b.upDir - a.upDir);
+	k.fov = a.fov + w * (b.fov - a.fov);
+	return k;
+}
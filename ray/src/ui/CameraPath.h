@@ -0,0 +1,50 @@
+#ifndef __CAMERAPATH_H__
+#define __CAMERAPATH_H__
+
+#include <string>
+#include <vector>
+#include <glm/vec3.hpp>
+
+/*
+   CameraPath is a camera move for rendering an animation in one run
+   (the command line's -a option).  It is read from a JSON file:
+
+     {
+       "frames": 48,
+       "keys": [
+         { "position": [0, 0, 10], "viewdir": [0, 0, -1],
+           "updir": [0, 1, 0], "fov": 30 },
+         { "position": [4, 0, 8] }
+       ]
+     }
+
+   The keys are spread evenly over the frames, the first at frame 0
+   and the last at the last frame, and the camera moves in straight
+   lines between them.  The fields are the ones of a .ray camera; a
+   key leaves out the ones that stay as they were in the key before,
+   and the first key gets its missing ones from the scene's camera.
+*/
+class CameraPath {
+public:
+	struct Key {
+		glm::dvec3 position;
+		glm::dvec3 viewDir;
+		glm::dvec3 upDir;
+		double fov;
+	};
+
+	// Read the path from file.  start is the scene's camera.  Returns
+	// false, with a message in error, if the file can't be read or
+	// doesn't describe a path.
+	bool load(const std::string& file, const Key& start, std::string& error);
+
+	int frames() const { return frameCount; }
+	// The camera for frame f, 0 <= f < frames().
+	Key at(int f) const;
+
+private:
+	int frameCount = 0;
+	std::vector<Key> keys;
+};
+
+#endif // __CAMERAPATH_H__
@@ -1,6 +1,11 @@
 #include <stdarg.h>
 #include <time.h>
+#include <chrono>
+#include <future>
 #include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
 #ifndef _MSC_VER
 #include <unistd.h>
 #else
@@ -15,6 +20,10 @@ extern int getopt(int argc, char** argv, const char* optstring);
 #include "CommandLineUI.h"
 
 #include "../RayTracer.h"
+#include "../scene/scene.h"
+#include "../scene/shadowCache.h"
+#include "BatchManifest.h"
+#include "CameraPath.h"
 
 using namespace std;
 
@@ -25,8 +34,7 @@ CommandLineUI::CommandLineUI(int argc, char** argv) : TraceUI()
 	int i;
 	progName = argv[0];
 	const char* jsonfile = nullptr;
-	string cubemap_file;
-	while ((i = getopt(argc, argv, "tr:w:hj:c:")) != EOF) {
+	while ((i = getopt(argc, argv, "tr:w:hj:c:a:b:")) != EOF) {
 		switch (i) {
 			case 'r':
 				m_nDepth = atoi(optarg);
@@ -38,7 +46,13 @@ CommandLineUI::CommandLineUI(int argc, char** argv) : TraceUI()
 				jsonfile = optarg;
 				break;
 			case 'c':
-				cubemap_file = optarg;
+				cubemapFile = optarg;
+				break;
+			case 'a':
+				cameraPathFile = optarg;
+				break;
+			case 'b':
+				batchFile = optarg;
 				break;
 			case 'h':
 				usage();
@@ -54,10 +68,18 @@ CommandLineUI::CommandLineUI(int argc, char** argv) : TraceUI()
 	if (jsonfile) {
 		loadFromJson(jsonfile);
 	}
-	if (!cubemap_file.empty()) {
-		smartLoadCubemap(cubemap_file);
+	if (!cubemapFile.empty()) {
+		smartLoadCubemap(cubemapFile);
 	}
 
+	if (batchFile) {
+		if (cameraPathFile) {
+			std::cerr << "-a and -b don't go together." << std::endl;
+			exit(1);
+		}
+		rayName = imgName = nullptr;
+		return;
+	}
 	if (optind >= argc - 1) {
 		std::cerr << "no input and/or output name." << std::endl;
 		exit(1);
@@ -70,12 +92,17 @@ CommandLineUI::CommandLineUI(int argc, char** argv) : TraceUI()
 int CommandLineUI::run()
 {
 	assert(raytracer != 0);
+	if (batchFile)
+		return renderBatch();
 	raytracer->loadScene(rayName);
 
 	if (raytracer->sceneLoaded()) {
 		int width = m_nSize;
 		int height = (int)(width / raytracer->aspectRatio() + 0.5);
 
+		if (cameraPathFile)
+			return renderSequence(width, height);
+
 		raytracer->traceSetup(width, height);
 
 		clock_t start, end;
@@ -99,6 +126,10 @@ int CommandLineUI::run()
 			writeImage(imgName, width, height, buf);
 
 		double t = (double)(end - start) / CLOCKS_PER_SEC;
+		if (shadowSw())
+			std::cerr << "shadow cache: " << ShadowCache::hits()
+			          << " hits, " << ShadowCache::misses()
+			          << " misses" << std::endl;
 		//		int totalRays = TraceUI::resetCount();
 		//		std::cout << "total time = " << t << " seconds,
 		// rays traced = " << totalRays << std::endl;
@@ -110,6 +141,194 @@ int CommandLineUI::run()
 	}
 }
 
+// imgName with the frame number before its extension, out.bmp ->
+// out_0007.bmp
+static string frameName(const string& name, int frame)
+{
+	char number[16];
+	snprintf(number, sizeof(number), "_%04d", frame);
+	size_t dot = name.find_last_of('.');
+	size_t slash = name.find_last_of("\\/");
+	if (dot == string::npos || (slash != string::npos && dot < slash))
+		return name + number;
+	return name.substr(0, dot) + number + name.substr(dot);
+}
+
+int CommandLineUI::renderSequence(int width, int height)
+{
+	const Camera& camera = raytracer->getScene().getCamera();
+	CameraPath::Key start;
+	start.position = camera.getEye();
+	start.viewDir = camera.getLook();
+	start.upDir = glm::normalize(camera.getV());
+	start.fov = camera.getFOV();
+
+	CameraPath path;
+	string error;
+	if (!path.load(cameraPathFile, start, error)) {
+		alert(error);
+		return 1;
+	}
+
+	// each frame shades again only what it can't take from the last
+	raytracer->setReprojection(true);
+	for (int f = 0; f < path.frames(); f++) {
+		CameraPath::Key k = path.at(f);
+		raytracer->setCamera(k.position, k.viewDir, k.upDir, k.fov);
+		raytracer->traceImage(width, height);
+		raytracer->waitRender();
+		if (aaSwitch()) {
+			raytracer->aaImage();
+			raytracer->waitRender();
+		}
+
+		unsigned char* buf;
+		raytracer->getBuffer(buf, width, height);
+		if (buf)
+			writeImage(frameName(imgName, f).c_str(), width, height, buf);
+		std::cerr << "frame " << f << ": " << raytracer->reprojectedPixels()
+		          << " of " << width * height << " pixels reprojected"
+		          << std::endl;
+	}
+	return 0;
+}
+
+namespace {
+
+// What a scene is read from, and how.  A job whose scene has the same
+// source as the one loaded keeps that scene, with its kd-tree and
+// light index.
+struct SceneSource {
+	string file;
+	time_t mtime = 0;
+	long long bytes = -1;
+	bool useCache = false;
+	bool bakeMeshes = false;
+
+	bool operator==(const SceneSource& o) const
+	{
+		return file == o.file && mtime == o.mtime && bytes == o.bytes &&
+		       useCache == o.useCache && bakeMeshes == o.bakeMeshes;
+	}
+	bool operator!=(const SceneSource& o) const { return !(*this == o); }
+};
+
+SceneSource sourceOf(const string& file, bool useCache, bool bakeMeshes)
+{
+	SceneSource s;
+	s.file = file;
+	s.useCache = useCache;
+	s.bakeMeshes = bakeMeshes;
+	struct stat st;
+	if (stat(file.c_str(), &st) == 0) {
+		s.mtime = st.st_mtime;
+		s.bytes = st.st_size;
+	}
+	return s;
+}
+
+// A scene read ahead of the job that renders it.
+struct ReadScene {
+	std::unique_ptr<Scene> scene;
+	string error;
+};
+
+ReadScene readScene(const SceneSource& source)
+{
+	ReadScene r;
+	r.scene = RayTracer::readScene(source.file.c_str(), source.useCache,
+	                               source.bakeMeshes, r.error);
+	return r;
+}
+
+} // anonymous namespace
+
+int CommandLineUI::renderBatch()
+{
+	BatchManifest manifest;
+	string error;
+	if (!manifest.load(batchFile, error)) {
+		alert(error);
+		return 1;
+	}
+	const std::vector<BatchManifest::Job>& jobs = manifest.jobs();
+
+	// The render threads, the decoded textures and cube map, and the
+	// scene if the next job renders the same one, all carry over from
+	// one job to the next.  While a job renders, the next job's scene
+	// is read on a thread of its own.
+	SceneSource loaded;	// of the scene loaded
+	SceneSource ahead;	// of the scene in reading
+	std::future<ReadScene> reading;
+	int failed = 0;
+
+	for (size_t n = 0; n < jobs.size(); n++) {
+		const BatchManifest::Job& job = jobs[n];
+		auto start = std::chrono::steady_clock::now();
+
+		if (!job.settings.empty()) {
+			std::istringstream in(job.settings);
+			loadFromJson(in);
+		}
+		if (!job.cubemap.empty() && job.cubemap != cubemapFile) {
+			cubemapFile = job.cubemap;
+			smartLoadCubemap(cubemapFile);
+		}
+
+		SceneSource source = sourceOf(job.scene, sceneCacheSw(),
+		                              bakeMeshesSw());
+		// The scene read ahead is this job's, unless the job's settings
+		// changed how it should be read.
+		ReadScene next;
+		if (reading.valid())
+			next = reading.get();
+		if (!raytracer->sceneLoaded() || source != loaded) {
+			if (!next.scene || ahead != source)
+				next = readScene(source);
+			if (!next.scene) {
+				alert(next.error);
+				std::cerr << "Unable to load ray file '" << job.scene
+				          << "'" << std::endl;
+				failed++;
+				continue;
+			}
+			raytracer->useScene(std::move(next.scene));
+			loaded = source;
+		}
+
+		int width = m_nSize;
+		int height = (int)(width / raytracer->aspectRatio() + 0.5);
+		raytracer->traceImage(width, height);
+
+		if (n + 1 < jobs.size()) {
+			const BatchManifest::Job& next = jobs[n + 1];
+			bool useCache = next.sceneCache < 0 ? sceneCacheSw()
+			                                    : next.sceneCache != 0;
+			bool bakeMeshes = next.bakeMeshes < 0 ? bakeMeshesSw()
+			                                      : next.bakeMeshes != 0;
+			ahead = sourceOf(next.scene, useCache, bakeMeshes);
+			if (ahead != loaded)
+				reading = std::async(std::launch::async, readScene, ahead);
+		}
+
+		raytracer->waitRender();
+		if (aaSwitch()) {
+			raytracer->aaImage();
+			raytracer->waitRender();
+		}
+
+		unsigned char* buf;
+		raytracer->getBuffer(buf, width, height);
+		if (buf)
+			writeImage(job.output.c_str(), width, height, buf);
+		std::chrono::duration<double> t =
+		        std::chrono::steady_clock::now() - start;
+		std::cerr << job.output << ": " << t.count() << " seconds"
+		          << std::endl;
+	}
+	return failed ? 1 : 0;
+}
+
 void CommandLineUI::alert(const string& msg)
 {
 	std::cerr << msg << std::endl;
@@ -123,5 +342,9 @@ void CommandLineUI::usage()
 	     << "  -r <#>      set recursion level (default " << m_nDepth << ")" << endl
 	     << "  -w <#>      set output image width (default " << m_nSize << ")" << endl
 	     << "  -j <FILE>   set parameters from JSON file" << endl
-	     << "  -c <FILE>   one Cubemap file, the remainings will be detected automatically" << endl;
+	     << "  -c <FILE>   one Cubemap file, the remainings will be detected automatically" << endl
+	     << "  -a <FILE>   render the frames of a camera path from JSON file," << endl
+	     << "              numbering the output names" << endl
+	     << "  -b <FILE>   render the jobs listed in a JSON batch file, in place" << endl
+	     << "              of input.ray and output.png" << endl;
 }
@@ -19,10 +19,17 @@ public:
 
 private:
 	void		usage();
+	// Render each frame of the camera path in cameraPathFile.
+	int		renderSequence(int width, int height);
+	// Render each job of the manifest in batchFile.
+	int		renderBatch();
 
 	char*	rayName;
 	char*	imgName;
 	char*	progName;
+	const char*	cameraPathFile = nullptr;
+	const char*	batchFile = nullptr;
+	string	cubemapFile;	// the cube map loaded, if any
 };
 
 #endif
@@ -1,6 +1,7 @@
 #include "CubeMapChooser.h"
 #include "../scene/cubeMap.h"
 #include "../scene/material.h"
+#include "../scene/textureCache.h"
 #include "../ui/GraphicalUI.h"
 #include <iostream>
 
@@ -110,7 +111,7 @@ void CubeMapChooser::cb_ok(Fl_Widget* o, void* v)
 		}
 		cm = ch->caller->getCubeMap();
 		for (int i = 0; i < 6; i++)
-			cm->setNthMap(i, ch->cubeFace[i].release());
+			cm->setNthMap(i, std::move(ch->cubeFace[i]));
 		ch->caller->useCubeMap(true);
 		ch->caller->m_filterSlider->activate();
 		ch->caller->m_cubeMapCheckButton->activate();
@@ -234,7 +235,8 @@ void CubeMapChooser::cb_smartLoad(Fl_Widget* o, void* v)
 bool CubeMapChooser::loadImageInto(const char *curPath, int i, bool sync_dir)
 {
 	try {
-		cubeFace[i].reset(new TextureMap(curPath));
+		cubeFace[i] = TextureCache::instance().get(curPath);
+		cubeFace[i]->load();
 	} catch (TextureMapException &xcpt) {
 		fb[i]->selection_color(FL_RED);
 		fb[i]->value(0);
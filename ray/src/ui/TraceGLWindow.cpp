@@ -43,6 +43,9 @@ int TraceGLWindow::handle(int event)
 			// Have we re-sized since drawing?
 			if(!raytracer->isReady()) 
 				raytracer->traceSetup(m_nWindowWidth, m_nWindowHeight);
+			else
+				// pick up the debugging switch and the like
+				raytracer->syncSettings();
 
 			debugMode = true;
 			raytracer->tracePixel(x, y);
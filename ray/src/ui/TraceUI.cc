@@ -7,6 +7,7 @@
 #endif
 #include "../scene/cubeMap.h"
 #include "../scene/material.h"
+#include "../scene/textureCache.h"
 
 /*
  * JSON for Modern C++
@@ -46,8 +47,13 @@ void TraceUI::setCubeMap(CubeMap* cm)
 void TraceUI::loadFromJson(const char* file)
 {
 	std::ifstream fin(file);
+	loadFromJson(fin);
+}
+
+void TraceUI::loadFromJson(std::istream& in)
+{
 	Json json;
-	fin >> json;
+	in >> json;
 
 	load(json, "threads", m_threads);
 	load(json, "size", m_nSize);
@@ -59,11 +65,15 @@ void TraceUI::loadFromJson(const char* file)
 	load(json, "tree_depth", m_nTreeDepth);
 	load(json, "leaf_size", m_nLeafSize);
 	load(json, "filter_width", m_nFilterWidth);
+	load(json, "light_samples", m_nLightSamples);
 	load(json, "anti_alias", m_antiAlias);
 	load(json, "kdtree", m_kdTree);
 	load(json, "shadows", m_shadows);
 	load(json, "smoothshade", m_smoothshade);
 	load(json, "backface_culling", m_backface);
+	load(json, "scene_cache", m_sceneCache);
+	load(json, "bake_meshes", m_bakeMeshes);
+	load(json, "wavefront", m_wavefront);
 	/*
 	 * Note for Students:
 	 * The following options are legacy from previous semesters.
@@ -165,8 +175,16 @@ void TraceUI::smartLoadCubemap(const string& file)
 			setCubeMap(new CubeMap());
 		}
 		try {
-			for (int i = 0; i < 6; i++)
-				cubemap->setNthMap(i, new TextureMap(pdir + "/" + matched_fn[i]));
+			// decode the six faces in parallel
+			std::shared_ptr<TextureMap> faces[6];
+			for (int i = 0; i < 6; i++) {
+				faces[i] = TextureCache::instance().get(pdir + "/" + matched_fn[i]);
+				TextureCache::instance().prefetch(faces[i]);
+			}
+			for (int i = 0; i < 6; i++) {
+				faces[i]->load();
+				cubemap->setNthMap(i, faces[i]);
+			}
 		} catch (TextureMapException &xcpt) {
 			cubemap.reset();
 			std::cerr << xcpt.message() << std::endl;
@@ -7,6 +7,7 @@
 #ifndef __TraceUI_h__
 #define __TraceUI_h__
 
+#include <iosfwd>
 #include <string>
 #include <memory>
 #define MAX_THREADS 32
@@ -40,12 +41,16 @@ public:
 	int getMaxDepth() const { return m_nTreeDepth; }
 	int getLeafSize() const { return m_nLeafSize; }
 	int getFilterWidth() const { return m_nFilterWidth; }
+	int getLightSamples() const { return m_nLightSamples; }
 	int getThreads() const { return m_threads; }
 	bool aaSwitch() const { return m_antiAlias; }
 	bool kdSwitch() const { return m_kdTree; }
 	bool shadowSw() const { return m_shadows; }
 	bool smShadSw() const { return m_smoothshade; }
 	bool bkFaceSw() const { return m_backface; }
+	bool sceneCacheSw() const { return m_sceneCache; }
+	bool bakeMeshesSw() const { return m_bakeMeshes; }
+	bool wavefrontSw() const { return m_wavefront; }
 	bool cubeMap() const { return m_usingCubeMap && cubemap; }
 	CubeMap* getCubeMap() const { return cubemap.get(); }
 	void setCubeMap(CubeMap* cm);
@@ -107,6 +112,7 @@ protected:
 	int m_nTreeDepth = 15;    // maximum kdTree depth
 	int m_nLeafSize = 10;     // target number of objects per leaf
 	int m_nFilterWidth = 1;   // width of cubemap filter
+	int m_nLightSamples = 0;  // lights sampled per shading point, 0 for all
 
 	static int rayCount[MAX_THREADS]; // Ray counter
 
@@ -119,6 +125,9 @@ protected:
 	bool m_shadows = true;       // compute shadows?
 	bool m_smoothshade = true;   // turn on/off smoothshading?
 	bool m_backface = true;      // cull backfaces?
+	bool m_sceneCache = true;    // keep parsed scenes and kd-trees on disk?
+	bool m_bakeMeshes = true;    // move trimeshes into world space at load?
+	bool m_wavefront = false;    // trace tiles a generation of rays at a time?
 	bool m_usingCubeMap = false; // render with cubemap
 	bool m_internalReflection = true; // Enable reflection inside a translucent object.
 	bool m_backfaceSpecular = false; // Enable specular component even seeing through the back of a translucent object.
@@ -126,6 +135,8 @@ protected:
 	std::unique_ptr<CubeMap> cubemap;
 
 	void loadFromJson(const char* file);
+	// The same, from JSON text; fields it leaves out keep their value.
+	void loadFromJson(std::istream& in);
 	void smartLoadCubemap(const string& file);
 };
 
@@ -1,6 +1,7 @@
 #pragma warning(disable : 4786)
 
 #include "debuggingView.h"
+#include <cmath>
 #include <string.h>
 #include <iostream>
 #include "../RayTracer.h"
@@ -497,7 +498,11 @@ void DebuggingView::drawRays()
 		}
 		glm::dvec3 p          = rayItr->first->getPosition();
 		glm::dvec3 d          = rayItr->first->getDirection();
-		glm::dvec3 isectPoint = p + rayItr->second->getT() * d;
+		// a ray that missed goes out to the far plane
+		double t = rayItr->second->getT();
+		if (std::isinf(t))
+			t = 1000.0;
+		glm::dvec3 isectPoint = p + t * d;
 
 		glEnable(GL_LINE_STIPPLE);
 		glLineStipple(1, 0x3333);